@@ -0,0 +1,344 @@
+/*
+ * ImageUpscalerQt - command line parsing functions
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <iterator>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include "CommandLine.hpp"
+#include "../functions/func.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
+
+const char* const cli::TASK_SYNTAX_HELP =
+	"Task syntax (tasks are applied in the order they are specified):\n"
+	"  resize:WIDTHxHEIGHT[:interpolation]\n"
+	"      interpolation is one of bspline, bilinear (default), blackman-harris, box,\n"
+	"      catmull-rom, cubic, gaussian, lanczos3, mitchell, radial-lanczos3,\n"
+	"      rifman, sharp-gaussian, simon, sinc.\n"
+	"  colorspace:rgb_to_ycbcr|ycbcr_to_rgb|rgb_to_ycocg|ycocg_to_rgb\n"
+	"  srcnn:KERNELS CHANNELS[:block_size][:luma][:bf16|:int8]\n"
+	"      for example \"srcnn:9-3-5 64-32:256\".\n"
+	"  fsrcnn:xMULTIPLIER KERNELS CHANNELS[:block_size][:luma][:bf16|:int8]\n"
+	"      for example \"fsrcnn:x3 5-1-3-1-9 128-16-48-128:128:luma\".\n"
+	"  upscale:WIDTHxHEIGHT|xSCALE[:low|medium|high][:block_size][:luma][:bf16|:int8]\n"
+	"      for example \"upscale:3840x2160\" or \"upscale:x4:high\". Runs the cheapest chain\n"
+	"      of the installed networks and resizes that meets the quality (medium by default),\n"
+	"      planned for the size of every image. The plans and theirs costs for the first images\n"
+	"      are printed before running. Only on the command line, the GUI has no such task.\n"
+	"  block_size 0 (default) means that the image is not split into blocks, auto chooses\n"
+	"      it for every image from the CPU cache size and the free memory.\n"
+	"  Blocks overlap by the receptive field of the network, so they don't leave seams.\n"
+	"  luma runs the neural network only on the luma, the chroma is resized.\n"
+	"  bf16 computes in bfloat16 if the CPU supports it natively (f32 otherwise).\n"
+	"  int8 computes with a quantized model created by imageupscalerqt-calibrate.";
+
+/// Color space conversion names for the command line.
+const char* const COLOR_SPACE_CONVERSION_CLI_NAMES[4] = {
+	"rgb_to_ycbcr", "ycbcr_to_rgb", "rgb_to_ycocg", "ycocg_to_rgb"
+};
+
+/// Parse a positive size like "3840x2160".
+/// @returns false if the string is not a valid size.
+bool parse_size(const QString& str, QSize& size) {
+	QStringList size_parts = str.split('x');
+	bool ok_w = false, ok_h = false;
+	const int width = size_parts.size() == 2 ? size_parts[0].toInt(&ok_w) : 0;
+	const int height = size_parts.size() == 2 ? size_parts[1].toInt(&ok_h) : 0;
+	size = QSize(width, height);
+	return ok_w && ok_h && width > 0 && height > 0;
+}
+
+std::shared_ptr<TaskDesc> parse_resize(const QStringList& parts, QString& error) {
+	if (parts.size() < 2 || parts.size() > 3) {
+		error = "Resize task must look like \"resize:WIDTHxHEIGHT[:interpolation]\".";
+		return nullptr;
+	}
+
+	QSize size;
+	if (!parse_size(parts[1], size)) {
+		error = QString("Invalid resize size \"%1\".").arg(parts[1]);
+		return nullptr;
+	}
+
+	Interpolation interpolation = Interpolation::bilinear;
+	if (parts.size() == 3) {
+		bool found = false;
+		for (unsigned char i = 0; i < std::size(INTERPOLATION_OIIO_NAMES); i++) {
+			if (parts[2].compare(INTERPOLATION_OIIO_NAMES[i], Qt::CaseInsensitive) == 0 ||
+				parts[2].compare(INTERPOLATION_NAMES[i], Qt::CaseInsensitive) == 0) {
+				interpolation = static_cast<Interpolation>(i);
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			error = QString("Unknown interpolation \"%1\".").arg(parts[2]);
+			return nullptr;
+		}
+	}
+
+	return std::make_shared<TaskResizeDesc>(interpolation, size);
+}
+
+std::shared_ptr<TaskDesc> parse_color_space(const QStringList& parts, QString& error) {
+	if (parts.size() == 2) {
+		for (unsigned char i = 0; i < std::size(COLOR_SPACE_CONVERSION_CLI_NAMES); i++) {
+			if (parts[1].compare(COLOR_SPACE_CONVERSION_CLI_NAMES[i], Qt::CaseInsensitive) == 0)
+				return std::make_shared<TaskConvertColorSpaceDesc>(static_cast<ColorSpaceConversion>(i));
+		}
+	}
+
+	error = "Color space task must look like \"colorspace:rgb_to_ycbcr\" "
+			"(or ycbcr_to_rgb, rgb_to_ycocg, ycocg_to_rgb).";
+	return nullptr;
+}
+
+/// Remove the trailing flags ("luma", "f32", "bf16", "int8") of a neural network task.
+void take_flags(QStringList& parts, bool& luma_only, Precision& precision) {
+	luma_only = false;
+	precision = Precision::f32;
+
+	while (parts.size() > 2) {
+		const QString flag = parts.last().trimmed().toLower();
+		if (flag == "luma") {
+			luma_only = true;
+		}
+		else if (flag == PRECISION_NAMES[static_cast<unsigned char>(Precision::f32)]) {
+			precision = Precision::f32;
+		}
+		else if (flag == PRECISION_NAMES[static_cast<unsigned char>(Precision::bf16)]) {
+			precision = Precision::bf16;
+		}
+		else if (flag == PRECISION_NAMES[static_cast<unsigned char>(Precision::int8)]) {
+			precision = Precision::int8;
+		}
+		else {
+			break;
+		}
+
+		parts.removeLast();
+	}
+}
+
+/// Check that the quantized model exists if the precision is int8.
+bool check_quantized_model(const QString& kind, const QString& desc, Precision precision, QString& error) {
+	if (precision != Precision::int8 || QFile::exists(NetworkCache::quantized_model_path(kind, desc)))
+		return true;
+
+	error = QString("There is no int8 model of the %1 %2. Create it with imageupscalerqt-calibrate.").arg(
+		kind.toUpper(), desc);
+	return false;
+}
+
+/// Parse an optional non-negative block size or "auto".
+bool parse_block_size(const QStringList& parts, int index, int& block_size, QString& error) {
+	block_size = 0;
+	if (parts.size() <= index)
+		return true;
+
+	if (parts[index].trimmed().compare("auto", Qt::CaseInsensitive) == 0) {
+		block_size = AUTO_BLOCK_SIZE;
+		return true;
+	}
+
+	bool ok;
+	block_size = parts[index].toInt(&ok);
+	if (!ok || block_size < 0 || (block_size > 0 && block_size < 16)) {
+		error = QString("Invalid block size \"%1\". It must be 0, auto or at least 16.").arg(parts[index]);
+		return false;
+	}
+
+	return true;
+}
+
+std::shared_ptr<TaskDesc> parse_srcnn(QStringList parts, QString& error) {
+	bool luma_only;
+	Precision precision;
+	take_flags(parts, luma_only, precision);
+
+	SRCNNDesc srcnn_desc;
+	if (parts.size() < 2 || parts.size() > 3 || !SRCNNDesc::from_string(parts[1], &srcnn_desc)) {
+		error = "SRCNN task must look like \"srcnn:9-3-5 64-32[:block_size][:luma][:bf16|:int8]\".";
+		return nullptr;
+	}
+
+	if (!QFile::exists(ModelStore::instance().network_model_path("srcnn", srcnn_desc.to_string()))) {
+		error = QString("There is no SRCNN with the \"%1\" architecture.").arg(parts[1]);
+		return nullptr;
+	}
+
+	if (!check_quantized_model("srcnn", srcnn_desc.to_string(), precision, error))
+		return nullptr;
+
+	int block_size;
+	if (!parse_block_size(parts, 2, block_size, error))
+		return nullptr;
+
+	return std::make_shared<TaskSRCNNDesc>(srcnn_desc, block_size, luma_only, precision);
+}
+
+std::shared_ptr<TaskDesc> parse_fsrcnn(QStringList parts, QString& error) {
+	bool luma_only;
+	Precision precision;
+	take_flags(parts, luma_only, precision);
+
+	FSRCNNDesc fsrcnn_desc;
+	if (parts.size() < 2 || parts.size() > 3 || !FSRCNNDesc::from_string(parts[1], &fsrcnn_desc)) {
+		error = "FSRCNN task must look like \"fsrcnn:x3 5-1-3-1-9 128-16-48-128[:block_size][:luma][:bf16|:int8]\".";
+		return nullptr;
+	}
+
+	if (!QFile::exists(ModelStore::instance().network_model_path("fsrcnn", fsrcnn_desc.to_string()))) {
+		error = QString("There is no FSRCNN with the \"%1\" architecture.").arg(parts[1]);
+		return nullptr;
+	}
+
+	if (!check_quantized_model("fsrcnn", fsrcnn_desc.to_string(), precision, error))
+		return nullptr;
+
+	int block_size;
+	if (!parse_block_size(parts, 2, block_size, error))
+		return nullptr;
+
+	return std::make_shared<TaskFSRCNNDesc>(fsrcnn_desc, block_size, luma_only, precision);
+}
+
+std::shared_ptr<TaskDesc> parse_upscale(QStringList parts, QString& error) {
+	bool luma_only;
+	Precision precision;
+	take_flags(parts, luma_only, precision);
+
+	const QString syntax_error = "Upscale task must look like \"upscale:WIDTHxHEIGHT[:low|medium|high][:block_size]"
+								 "[:luma][:bf16|:int8]\" or \"upscale:xSCALE[...]\".";
+	if (parts.size() < 2 || parts.size() > 4) {
+		error = syntax_error;
+		return nullptr;
+	}
+
+	// The target is a size or a factor.
+	QSize size;
+	double scale = 0.0;
+	const QString target = parts[1].trimmed();
+	if (target.startsWith('x')) {
+		bool ok;
+		scale = target.mid(1).toDouble(&ok);
+		if (!ok || scale <= 0.0) {
+			error = QString("Invalid upscale factor \"%1\".").arg(parts[1]);
+			return nullptr;
+		}
+	}
+	else if (!parse_size(target, size)) {
+		error = QString("Invalid upscale size \"%1\".").arg(parts[1]);
+		return nullptr;
+	}
+
+	// The quality is optional, the block size follows it.
+	UpscaleQuality quality = UpscaleQuality::medium;
+	int block_index = 2;
+	if (parts.size() > 2) {
+		for (unsigned char i = 0; i < std::size(UPSCALE_QUALITY_NAMES); i++) {
+			if (parts[2].trimmed().compare(UPSCALE_QUALITY_NAMES[i], Qt::CaseInsensitive) == 0) {
+				quality = static_cast<UpscaleQuality>(i);
+				block_index = 3;
+				break;
+			}
+		}
+	}
+
+	if (parts.size() > block_index + 1) {
+		error = syntax_error;
+		return nullptr;
+	}
+
+	int block_size;
+	if (!parse_block_size(parts, block_index, block_size, error))
+		return nullptr;
+
+	return std::make_shared<TaskUpscaleDesc>(size, scale, quality, block_size, luma_only, precision);
+}
+
+std::shared_ptr<TaskDesc> cli::parse_task(const QString& str, QString& error) {
+	// Architectures contain spaces and dashes, but never colons.
+	QStringList parts = str.split(':');
+	const QString kind = parts[0].trimmed().toLower();
+
+	if (kind == "resize")
+		return parse_resize(parts, error);
+	else if (kind == "colorspace")
+		return parse_color_space(parts, error);
+	else if (kind == "srcnn")
+		return parse_srcnn(parts, error);
+	else if (kind == "fsrcnn")
+		return parse_fsrcnn(parts, error);
+	else if (kind == "upscale")
+		return parse_upscale(parts, error);
+
+	error = QString("Unknown task \"%1\".").arg(parts[0]);
+	return nullptr;
+}
+
+QStringList cli::expand_inputs(const QStringList& args) {
+	QStringList result;
+
+	for (const QString& arg : args) {
+		if (!arg.contains('*') && !arg.contains('?') && !arg.contains('[')) {
+			result.push_back(arg);
+			continue;
+		}
+
+		// Wildcards are supported only in the file name part, like "folder/*.png".
+		QFileInfo info(arg);
+		QDir dir = info.dir();
+		QStringList matched = dir.entryList({info.fileName()}, QDir::Files);
+		func::numerical_sort(matched);
+		for (const QString& name : matched)
+			result.push_back(dir.filePath(name));
+	}
+
+	return result;
+}
+
+bool cli::read_file_list(const QString& path, std::vector<std::pair<QString, QString>>& files,
+						 QString& error) {
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) {
+		error = QString("Can't open the file list \"%1\".").arg(path);
+		return false;
+	}
+
+	QTextStream stream(&file);
+	int line_number = 0;
+	while (!stream.atEnd()) {
+		const QString line = stream.readLine();
+		line_number++;
+
+		if (line.trimmed().isEmpty() || line.startsWith('#'))
+			continue;
+
+		QStringList pair = line.split('\t');
+		if (pair.size() != 2 || pair[0].isEmpty() || pair[1].isEmpty()) {
+			error = QString("Line %1 of the file list must contain input and output paths "
+							"separated by a tab.").arg(line_number);
+			return false;
+		}
+
+		files.push_back(std::make_pair(pair[0], pair[1]));
+	}
+
+	return true;
+}
+
+QString cli::output_path(const QString& input, const QString& output_dir,
+						 const QString& suffix, const QString& extension) {
+	QFileInfo info(input);
+	const QString ext = extension.isEmpty() ? info.suffix() : extension;
+	return QDir(output_dir).filePath(info.completeBaseName() + suffix + '.' + ext);
+}
@@ -0,0 +1,45 @@
+/*
+ * ImageUpscalerQt - command line parsing functions header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+#include "../tasks/TaskDesc.hpp"
+
+namespace cli {
+	/// Human-readable description of the task syntax for the --help output.
+	extern const char* const TASK_SYNTAX_HELP;
+
+	/// Parse the task description from the command line.
+	/// Syntax:
+	/// "resize:WIDTHxHEIGHT[:interpolation]",
+	/// "colorspace:rgb_to_ycbcr|ycbcr_to_rgb|rgb_to_ycocg|ycocg_to_rgb",
+	/// "srcnn:9-3-5 64-32[:block_size]",
+	/// "fsrcnn:x3 5-1-3-1-9 128-16-48-128[:block_size]",
+	/// "upscale:3840x2160|x4[:low|medium|high][:block_size]".
+	/// @returns nullptr and sets the error message if the string is invalid.
+	std::shared_ptr<TaskDesc> parse_task(const QString& str, QString& error);
+
+	/// Expand wildcards ("images/*.png") that were not expanded by the shell.
+	/// Arguments without wildcards are returned as is.
+	QStringList expand_inputs(const QStringList& args);
+
+	/// Read pairs "input<TAB>output" from the list file, one pair per line.
+	/// Empty lines and lines starting with '#' are skipped.
+	/// @returns false and sets the error message if the file can't be read or parsed.
+	bool read_file_list(const QString& path, std::vector<std::pair<QString, QString>>& files,
+						QString& error);
+
+	/// Create the output path for the input image: output_dir/<input base name><suffix>.<extension>.
+	/// Input extension is used if the extension is empty.
+	QString output_path(const QString& input, const QString& output_dir,
+						const QString& suffix, const QString& extension);
+}
@@ -0,0 +1,294 @@
+/*
+ * ImageUpscalerQt - command line batch runner
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <OpenImageIO/imageio.h>
+
+#include "CommandLine.hpp"
+#include "../functions/func.hpp"
+#include "../nn/NetworkCache.hpp"
+#include "../tasks/Worker.hpp"
+
+/// Set by the SIGINT handler, the Worker is cancelled from the progress thread.
+volatile std::sig_atomic_t interrupted = 0;
+
+void sigint_handler(int) {
+	interrupted = 1;
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-cli");
+	// Resources are compiled into the static core library.
+	Q_INIT_RESOURCE(resources);
+
+	// BEGIN Parse arguments
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		QString("Headless batch runner of ImageUpscalerQt.\n\n") + cli::TASK_SYNTAX_HELP
+	);
+	parser.addHelpOption();
+	parser.addPositionalArgument("inputs", "Input images. Wildcards like \"folder/*.png\" are allowed.",
+								 "[inputs...]");
+
+	QCommandLineOption task_option({"t", "task"}, "Add a task to the chain (see the task syntax above).", "task");
+	QCommandLineOption output_option({"o", "output"}, "Output directory for the input images.", "directory");
+	QCommandLineOption suffix_option("suffix", "Suffix added to the output file names.", "suffix");
+	QCommandLineOption format_option({"f", "format"},
+									 "Extension of the output files (png, jpg, ...). "
+									 "The input extension is used by default.", "extension");
+	QCommandLineOption list_option({"l", "list"},
+								   "File with pairs \"input<TAB>output\", one per line. "
+								   "Can be combined with the positional inputs.", "file");
+	QCommandLineOption quiet_option({"q", "quiet"}, "Don't print the progress.");
+	QCommandLineOption queue_depth_option("queue-depth",
+										  "How many decoded and processed images may wait in memory "
+										  "for the next stage (2 by default).", "depth", "2");
+	QCommandLineOption concurrent_option("concurrent-images",
+										 "How many images are processed at once, every image gets its "
+										 "share of the cores. 0 (default) chooses automatically.",
+										 "amount", "0");
+
+	QCommandLineOption stream_option("stream",
+									 "Read, process and write the images by strips, so huge images don't have "
+									 "to fit in memory. Works with the colorspace, srcnn and fsrcnn tasks. "
+									 "TIFF and OpenEXR outputs are written with 64x64 tiles.");
+	QCommandLineOption strip_height_option("strip-height",
+										   "Input rows in a strip with --stream (256 by default).",
+										   "rows", "256");
+
+	QCommandLineOption memory_budget_option("memory-budget",
+											"Memory in MiB that the images in flight may take. Images wait for "
+											"the memory and the neural network blocks are reduced to stay "
+											"within it. 0 (default) takes 3/4 of the free memory, the limit "
+											"of the container's cgroup is respected.", "MiB", "0");
+	QCommandLineOption report_option("report",
+									 "Write the time of decoding, every task (with the neural network building "
+									 "and execution) and encoding of every image to this JSON file.", "file");
+
+	QCommandLineOption no_chain_optimization_option("no-chain-optimization",
+													"Run the tasks exactly as given. By default, the inverse color "
+													"space conversions cancel out, the consecutive resizes are "
+													"collapsed and the conversions around the luma-only neural "
+													"networks are fused into them.");
+
+	parser.addOptions({task_option, output_option, suffix_option, format_option, list_option, quiet_option,
+					   queue_depth_option, concurrent_option, stream_option, strip_height_option, memory_budget_option,
+					   report_option, no_chain_optimization_option});
+	parser.process(app);
+
+	// Tasks.
+	std::vector<std::shared_ptr<TaskDesc>> tasks;
+	for (const QString& task_str : parser.values(task_option)) {
+		QString error;
+		auto task = cli::parse_task(task_str, error);
+		if (task == nullptr) {
+			std::cerr << error.toStdString() << std::endl;
+			return 2;
+		}
+		tasks.push_back(task);
+	}
+
+	if (tasks.empty()) {
+		std::cerr << "No tasks specified. Use --task to add one." << std::endl;
+		return 2;
+	}
+
+	// Files.
+	std::vector<std::pair<QString, QString>> files;
+	if (parser.isSet(list_option)) {
+		QString error;
+		if (!cli::read_file_list(parser.value(list_option), files, error)) {
+			std::cerr << error.toStdString() << std::endl;
+			return 2;
+		}
+	}
+
+	const QStringList inputs = cli::expand_inputs(parser.positionalArguments());
+	if (!inputs.isEmpty() && !parser.isSet(output_option)) {
+		std::cerr << "Output directory must be specified with --output." << std::endl;
+		return 2;
+	}
+
+	for (const QString& input : inputs) {
+		files.push_back(std::make_pair(input, cli::output_path(input, parser.value(output_option),
+				parser.value(suffix_option), parser.value(format_option))));
+	}
+
+	if (files.empty()) {
+		std::cerr << "No input images." << std::endl;
+		return 2;
+	}
+
+	bool queue_depth_ok;
+	const int queue_depth = parser.value(queue_depth_option).toInt(&queue_depth_ok);
+	if (!queue_depth_ok || queue_depth < 1) {
+		std::cerr << "Queue depth must be a positive number." << std::endl;
+		return 2;
+	}
+
+	bool concurrent_ok;
+	const int concurrent_images = parser.value(concurrent_option).toInt(&concurrent_ok);
+	if (!concurrent_ok || concurrent_images < 0) {
+		std::cerr << "Amount of concurrent images must be a non-negative number." << std::endl;
+		return 2;
+	}
+
+	bool strip_height_ok;
+	const int strip_height = parser.value(strip_height_option).toInt(&strip_height_ok);
+	if (!strip_height_ok || strip_height < 1) {
+		std::cerr << "Strip height must be a positive number." << std::endl;
+		return 2;
+	}
+
+	bool memory_budget_ok;
+	const unsigned long long memory_budget = parser.value(memory_budget_option).toULongLong(&memory_budget_ok);
+	if (!memory_budget_ok) {
+		std::cerr << "Memory budget must be a non-negative number." << std::endl;
+		return 2;
+	}
+
+	if (parser.isSet(output_option) && !QDir().mkpath(parser.value(output_option))) {
+		std::cerr << "Can't create the output directory." << std::endl;
+		return 1;
+	}
+
+	// Refuse to overwrite input images.
+	auto duplicates = func::duplicate_indexes([&files]() {
+		QStringList list;
+		for (const auto& pair : files)
+			list << QDir::cleanPath(pair.first) << QDir::cleanPath(pair.second);
+		return list;
+	}());
+	if (!duplicates.empty()) {
+		std::cerr << "Some paths are used more than once (an output overwrites an input "
+					 "or another output)." << std::endl;
+		return 2;
+	}
+	// END Parse arguments
+
+	// Count pixels before and after the tasks for the throughput report.
+	unsigned long long input_pixels = 0, output_pixels = 0;
+	for (const auto& pair : files) {
+		auto img_input = OIIO::ImageInput::open(pair.first.toStdString());
+		if (!img_input)
+			continue;
+
+		QSize size(img_input->spec().width, img_input->spec().height);
+		input_pixels += static_cast<unsigned long long>(size.width()) * size.height();
+		for (const auto& task : tasks)
+			size = task->img_size_after(size);
+		output_pixels += static_cast<unsigned long long>(size.width()) * size.height();
+	}
+
+	// Do tasks.
+	const bool quiet = parser.isSet(quiet_option);
+	Worker worker;
+	worker.set_chain_optimization(!parser.isSet(no_chain_optimization_option));
+	worker.init(tasks, files);
+	if (!quiet) {
+		for (const QString& rewrite : worker.get_chain_rewrites())
+			std::cerr << rewrite.toStdString() << std::endl;
+	}
+	worker.set_queue_depth(queue_depth);
+	worker.set_memory_budget(memory_budget * 1024ull * 1024ull);
+	if (concurrent_images != 0)
+		worker.set_concurrent_images(concurrent_images);
+	if (parser.isSet(stream_option)) {
+		if (!worker.can_stream()) {
+			std::cerr << "Only the colorspace, srcnn and fsrcnn tasks can be streamed." << std::endl;
+			return 2;
+		}
+		worker.set_strip_height(strip_height);
+	}
+	if (!quiet)
+		std::cerr << "Processing " << worker.get_concurrent_images() << " image(s) at once." << std::endl;
+	bool succeeded = false;
+	std::atomic<bool> finished = false;
+
+	std::signal(SIGINT, sigint_handler);
+
+	// Print the progress every second and react to Ctrl+C.
+	std::thread progress_thread([&]() {
+		int ticks = 0;
+		while (!finished) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			if (interrupted) {
+				interrupted = 0;
+				worker.cancel();
+			}
+
+			if (!quiet && ++ticks % 10 == 0) {
+				std::cerr << '[' << static_cast<int>(worker.overall_progress() * 100.0f) << "%] "
+						  << worker.cur_status().toStdString() << std::endl;
+			}
+		}
+	});
+
+	QElapsedTimer elapsed_timer;
+	elapsed_timer.start();
+	worker.do_tasks(
+		[&]() { // Success.
+			succeeded = true;
+		},
+		[&]() { // Cancelled.
+			std::cerr << "Cancelled." << std::endl;
+		},
+		[&](QString error) { // Error.
+			std::cerr << "Error: " << error.toStdString() << std::endl;
+		}
+	);
+	const auto elapsed = elapsed_timer.elapsed();
+
+	finished = true;
+	progress_thread.join();
+
+	// The report is written even if the batch failed, it shows how far it went.
+	if (parser.isSet(report_option) && !worker.write_report(parser.value(report_option))) {
+		std::cerr << "Can't write the report \"" << parser.value(report_option).toStdString() << "\"." << std::endl;
+		return 1;
+	}
+
+	if (!succeeded)
+		return 1;
+
+	// Throughput report.
+	const double seconds = std::max(elapsed, 1ll) / 1000.0;
+	std::cout << QString("Processed %1 images in %2.\n"
+						 "Throughput: %3 images/s, %4 MP/s input, %5 MP/s output.").arg(
+					 QString::number(files.size()),
+					 func::milliseconds_to_string(elapsed),
+					 QString::number(files.size() / seconds, 'f', 2),
+					 QString::number(input_pixels / 1'000'000.0 / seconds, 'f', 2),
+					 QString::number(output_pixels / 1'000'000.0 / seconds, 'f', 2)
+				 ).toStdString() << std::endl;
+
+	if (!quiet)
+		std::cerr << "Time: " << worker.timings_summary().toStdString() << '.' << std::endl;
+
+	const auto cache_stats = NetworkCache::instance().get_stats();
+	if (cache_stats.network_hits + cache_stats.network_misses != 0) {
+		std::cout << QString("Network cache: %1 hits, %2 misses; parameters: %3 hits, %4 misses.").arg(
+						 QString::number(cache_stats.network_hits),
+						 QString::number(cache_stats.network_misses),
+						 QString::number(cache_stats.params_hits),
+						 QString::number(cache_stats.params_misses)
+					 ).toStdString() << std::endl;
+	}
+
+	return 0;
+}
@@ -4,11 +4,29 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <functional>
+
 #include "func.hpp"
 
-int func::blocks_amount(const QSize full_size, const QSize block_size, const int block_margin) {
-	const int& block_width = block_size.width() + block_margin * 2;
-	const int& block_height = block_size.height() + block_margin * 2;
+/// Auto block sizes are multiples of this.
+constexpr int AUTO_BLOCK_STEP = 16;
+constexpr int MIN_AUTO_BLOCK_SIZE = 32;
+/// Maximal part of the computations that the halo around an auto block may add.
+constexpr double MAX_HALO_OVERHEAD = 0.5;
+/// Cache sizes used when they can't be detected.
+constexpr unsigned long long DEFAULT_L2_SIZE = 256ull * 1024ull;
+constexpr unsigned long long DEFAULT_L3_SIZE = 8ull * 1024ull * 1024ull;
+/// Maximal amount of pixels in a minibatch of the neural network when small blocks are batched together.
+constexpr long long MAX_BATCH_PIXELS = 512ll * 512ll;
+/// Blocks are not reduced below this size to fit in the memory limit.
+constexpr int MIN_LIMITED_BLOCK_SIZE = 16;
+
+int func::blocks_amount(const QSize full_size, const QSize block_size) {
+	const int& block_width = block_size.width();
+	const int& block_height = block_size.height();
 
 	int blocks_width = full_size.width() / block_width;
 	if (blocks_width * block_width < full_size.width())
@@ -62,9 +80,88 @@ unsigned long long func::fsrcnn_operations_amount(FSRCNNDesc desc,
 			static_cast<unsigned long long>(widths[i + 1]) * heights[i + 1] * 1ull;
 	}
 
+	// The deconvolution: every output pixel is made of (kernel / multiplier)^2 input pixels of every channel.
+	const unsigned long long deconv_taps = (desc.kernels[nn_size - 1] + desc.size_multiplier - 1) /
+		desc.size_multiplier;
+	result +=
+		widths[nn_size] * heights[nn_size] * desc.channels[nn_size] *
+		(2ull * desc.channels[nn_size - 1] * deconv_taps * deconv_taps - 1ull) +
+		widths[nn_size] * heights[nn_size] * 1ull;
+
 	return result;
 }
 
+/// Arithmetic operations of the color space conversion of a pixel: 3 channels of 3 multiplications and 3 additions.
+constexpr unsigned long long COLOR_CONVERSION_OPERATIONS = 18;
+
+/// Radius of the interpolation filter in the source pixels when enlarging (the filter widths of OpenImageIO).
+float interpolation_radius(Interpolation interpolation) {
+	switch (interpolation) {
+	case Interpolation::box:
+		return 0.5f;
+	case Interpolation::bilinear:
+	case Interpolation::sharp_gaussian:
+		return 1.0f;
+	case Interpolation::blackman_harris:
+	case Interpolation::gaussian:
+		return 1.5f;
+	case Interpolation::lanczos3:
+	case Interpolation::radial_lanczos3:
+		return 3.0f;
+	default:
+		return 2.0f;
+	}
+}
+
+/// Operations of the separable resize of one channel: a multiplication and an addition for every tap.
+unsigned long long resize_operations_amount(Interpolation interpolation, QSize size, QSize new_size) {
+	const auto taps = [&](int src, int dest) {
+		if (interpolation == Interpolation::bilinear)
+			return 2ull;
+		// Reducing stretches the filter.
+		const float scale = std::min(static_cast<float>(dest) / src, 1.0f);
+		return static_cast<unsigned long long>(std::ceil(interpolation_radius(interpolation) / scale)) * 2ull + 1ull;
+	};
+
+	return 2ull * taps(size.width(), new_size.width()) * new_size.width() * size.height() +
+		2ull * taps(size.height(), new_size.height()) * new_size.width() * new_size.height();
+}
+
+unsigned long long func::task_operations_amount(const TaskDesc& desc, QSize size, int channels) {
+	const QSize new_size = desc.img_size_after(size);
+	const unsigned long long pixels = static_cast<unsigned long long>(size.width()) * size.height();
+	const unsigned long long new_pixels = static_cast<unsigned long long>(new_size.width()) * new_size.height();
+
+	switch (desc.task_kind()) {
+	case TaskKind::resize:
+		return resize_operations_amount(static_cast<const TaskResizeDesc&>(desc).interpolation, size, new_size) *
+			channels;
+	case TaskKind::convert_color_space:
+		return pixels * COLOR_CONVERSION_OPERATIONS;
+	case TaskKind::srcnn: {
+		const auto& cnn_desc = static_cast<const TaskSRCNNDesc&>(desc);
+		if (!cnn_desc.luma_only || channels < 3)
+			return srcnn_operations_amount(cnn_desc.srcnn_desc, size) * channels;
+
+		// Y only, the other channels are copied.
+		return srcnn_operations_amount(cnn_desc.srcnn_desc, size) +
+			(!cnn_desc.ycbcr_input + !cnn_desc.ycbcr_output) * pixels * COLOR_CONVERSION_OPERATIONS;
+	}
+	case TaskKind::fsrcnn: {
+		const auto& cnn_desc = static_cast<const TaskFSRCNNDesc&>(desc);
+		if (!cnn_desc.luma_only || channels < 3)
+			return fsrcnn_operations_amount(cnn_desc.fsrcnn_desc, size) * channels;
+
+		// Y only, the other channels are resized with the triangle filter.
+		return fsrcnn_operations_amount(cnn_desc.fsrcnn_desc, size) +
+			resize_operations_amount(Interpolation::bilinear, size, new_size) * (channels - 1) +
+			(!cnn_desc.ycbcr_input * pixels + !cnn_desc.ycbcr_output * new_pixels) * COLOR_CONVERSION_OPERATIONS;
+	}
+	default:
+		return 0;
+	}
+}
+
 /// Predict the APPROXIMATE memory consumption of tensors that going throught the CNN.
 /// @returns Amount of bytes that will consumed.
 unsigned long long func::predict_cnn_memory_consumption(SRCNNDesc desc,
@@ -119,41 +216,274 @@ unsigned long long func::predict_cnn_memory_consumption(std::vector<unsigned sho
 	return max_point;
 }
 
-// Windows implementation of free_physical_memory.
+/// Common part of the auto_block_size() overloads.
+/// @param footprint Memory consumption of the neural network for the input size.
+int auto_block_size(int halo, QSize image_size, const std::function<unsigned long long(QSize)>& footprint) {
+	const auto window = [&](int block_size) {
+		return QSize(std::min(block_size + halo * 2, image_size.width()),
+					 std::min(block_size + halo * 2, image_size.height()));
+	};
+
+	func::CacheSizes caches = func::cpu_cache_sizes();
+	if (caches.l2 == 0)
+		caches.l2 = DEFAULT_L2_SIZE;
+	if (caches.l3 == 0)
+		caches.l3 = DEFAULT_L3_SIZE;
+	const unsigned long long cache_budget = caches.l2 + caches.l3 / func::hardware_threads();
+
+	// The largest block that fits in the cache.
+	const int max_size = std::max(image_size.width(), image_size.height());
+	int result = MIN_AUTO_BLOCK_SIZE;
+	for (int size = MIN_AUTO_BLOCK_SIZE; size < max_size + AUTO_BLOCK_STEP; size += AUTO_BLOCK_STEP) {
+		if (footprint(window(size)) > cache_budget)
+			break;
+		result = size;
+	}
+
+	// Smaller blocks spend too much on the halo: (size + 2 * halo)^2 <= size^2 * (1 + overhead).
+	const int min_size = static_cast<int>(std::ceil(halo * 2 / (std::sqrt(1.0 + MAX_HALO_OVERHEAD) - 1.0)));
+	result = std::max(result, (min_size + AUTO_BLOCK_STEP - 1) / AUTO_BLOCK_STEP * AUTO_BLOCK_STEP);
+
+	// But the memory is the hard limit. Leave most of it for the images. Unknown free memory doesn't limit.
+	const unsigned long long memory_budget = func::free_physical_memory().value_or(ULLONG_MAX) / 4ull;
+	while (result > MIN_AUTO_BLOCK_SIZE && footprint(window(result)) > memory_budget)
+		result -= AUTO_BLOCK_STEP;
+
+	if (result >= image_size.width() && result >= image_size.height())
+		return 0;
+	return result;
+}
+
+int func::auto_block_size(const SRCNNDesc& desc, QSize image_size) {
+	return ::auto_block_size(desc.halo(), image_size, [&desc](QSize size) {
+		return predict_cnn_memory_consumption(desc, size);
+	});
+}
+
+int func::auto_block_size(const FSRCNNDesc& desc, QSize image_size) {
+	return ::auto_block_size(desc.halo(), image_size, [&desc](QSize size) {
+		return predict_cnn_memory_consumption(desc, size);
+	});
+}
+
+/// Common part of the cnn_blocks() overloads.
+/// @param footprint Memory consumption of the neural network for the input size.
+func::CNNBlocks cnn_blocks(int halo, QSize image_size, int block_size, int channels, unsigned long long memory_limit,
+						   const std::function<unsigned long long(QSize)>& footprint) {
+	const auto window = [&](int size) {
+		return size == 0 ? image_size : QSize(std::min(size + halo * 2, image_size.width()),
+											  std::min(size + halo * 2, image_size.height()));
+	};
+	const auto fits = [&](int size) {
+		return memory_limit == 0 || footprint(window(size)) * channels <= memory_limit;
+	};
+
+	func::CNNBlocks result;
+	result.block_size = block_size;
+
+	// Reduce the block until all channels of it fit in the limit.
+	if (!fits(block_size)) {
+		int size = block_size == 0 ? std::max(image_size.width(), image_size.height()) : block_size;
+		while (size > MIN_LIMITED_BLOCK_SIZE && !fits(size))
+			size = std::max((size - 1) / AUTO_BLOCK_STEP * AUTO_BLOCK_STEP, MIN_LIMITED_BLOCK_SIZE);
+		result.block_size = size >= image_size.width() && size >= image_size.height() ? 0 : size;
+	}
+
+	result.window = window(result.block_size);
+	const long long window_pixels = static_cast<long long>(result.window.width()) * result.window.height();
+	const unsigned long long block_memory = footprint(result.window) * channels;
+
+	result.blocks_per_batch = std::max<long long>(1, MAX_BATCH_PIXELS / (window_pixels * channels));
+	if (memory_limit != 0)
+		result.blocks_per_batch = std::clamp<unsigned long long>(memory_limit / block_memory, 1, result.blocks_per_batch);
+	result.memory = block_memory * result.blocks_per_batch;
+	return result;
+}
+
+func::CNNBlocks func::cnn_blocks(const SRCNNDesc& desc, QSize image_size, int block_size, int channels,
+								 unsigned long long memory_limit) {
+	if (block_size == AUTO_BLOCK_SIZE)
+		block_size = auto_block_size(desc, image_size);
+
+	return ::cnn_blocks(desc.halo(), image_size, block_size, channels, memory_limit, [&desc](QSize size) {
+		return predict_cnn_memory_consumption(desc, size);
+	});
+}
+
+func::CNNBlocks func::cnn_blocks(const FSRCNNDesc& desc, QSize image_size, int block_size, int channels,
+								 unsigned long long memory_limit) {
+	if (block_size == AUTO_BLOCK_SIZE)
+		block_size = auto_block_size(desc, image_size);
+
+	return ::cnn_blocks(desc.halo(), image_size, block_size, channels, memory_limit, [&desc](QSize size) {
+		return predict_cnn_memory_consumption(desc, size);
+	});
+}
+
+// Windows implementation of free_physical_memory and cpu_cache_sizes.
 #ifdef Q_OS_WIN
 #include <windows.h>
 
-unsigned long long func::free_physical_memory() {
+std::optional<unsigned long long> func::free_physical_memory() {
 	// Use the Windows API for it.
 	MEMORYSTATUSEX statex;
 	statex.dwLength = sizeof(statex);
-	GlobalMemoryStatusEx(&statex);
+	if (!GlobalMemoryStatusEx(&statex))
+		return std::nullopt;
 	return statex.ullAvailPhys;
 }
 
+func::CacheSizes func::cpu_cache_sizes() {
+	CacheSizes result;
+
+	DWORD buffer_size = 0;
+	GetLogicalProcessorInformation(nullptr, &buffer_size);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(
+		buffer_size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (infos.empty() || !GetLogicalProcessorInformation(infos.data(), &buffer_size))
+		return result;
+
+	for (const auto& info : infos) {
+		if (info.Relationship != RelationCache || info.Cache.Type == CacheInstruction)
+			continue;
+
+		if (info.Cache.Level == 2)
+			result.l2 = info.Cache.Size;
+		else if (info.Cache.Level == 3)
+			result.l3 = std::max<unsigned long long>(result.l3, info.Cache.Size);
+	}
+
+	return result;
+}
+
 #endif
 
-// Linux implementation of free_physical_memory.
+// Linux implementation of free_physical_memory and cpu_cache_sizes.
 #ifdef Q_OS_LINUX
 #include <QFile>
 
-unsigned long long func::free_physical_memory() {
+/// Read a number from a cgroup file like "memory.current".
+/// @returns ULLONG_MAX if the file can't be read or contains "max".
+unsigned long long read_cgroup_value(const QString& path) {
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly | QFile::Text))
+		return ULLONG_MAX;
+
+	bool ok;
+	const unsigned long long result = QString(file.readAll()).trimmed().toULongLong(&ok);
+	return ok ? result : ULLONG_MAX;
+}
+
+/// Memory left to the cgroup v2 of the process: memory.max - memory.current of it and all its parents,
+/// the inactive page cache is counted as free (the kernel reclaims it first).
+/// @returns ULLONG_MAX if there are no limits or there is no cgroup v2.
+unsigned long long cgroup_free_memory() {
+	// cgroup v2 is the single "0::/path" line.
+	QFile cgroup_file("/proc/self/cgroup");
+	if (!cgroup_file.open(QFile::ReadOnly | QFile::Text))
+		return ULLONG_MAX;
+	QString path;
+	for (const QString& line : QString(cgroup_file.readAll()).split('\n')) {
+		if (line.startsWith("0::"))
+			path = line.mid(3).trimmed();
+	}
+	if (path.isEmpty())
+		return ULLONG_MAX;
+
+	// The limits of the parents apply too. In a container with its own cgroup namespace
+	// the path is "/" and the root of /sys/fs/cgroup is the cgroup of the container.
+	unsigned long long result = ULLONG_MAX;
+	while (true) {
+		const QString dir = "/sys/fs/cgroup" + (path == "/" ? QString() : path) + "/";
+		const unsigned long long max = read_cgroup_value(dir + "memory.max");
+		unsigned long long current = read_cgroup_value(dir + "memory.current");
+
+		if (max != ULLONG_MAX && current != ULLONG_MAX) {
+			QFile stat_file(dir + "memory.stat");
+			if (stat_file.open(QFile::ReadOnly | QFile::Text)) {
+				for (const QString& line : QString(stat_file.readAll()).split('\n')) {
+					if (line.startsWith("inactive_file "))
+						current -= std::min(current, line.mid(sizeof "inactive_file").toULongLong());
+				}
+			}
+
+			result = std::min(result, max > current ? max - current : 0ull);
+		}
+
+		if (path == "/" || path.isEmpty())
+			break;
+		path = path.left(path.lastIndexOf('/'));
+		if (path.isEmpty())
+			path = "/";
+	}
+
+	return result;
+}
+
+std::optional<unsigned long long> func::free_physical_memory() {
 	// Read data from the /proc/meminfo pseudofile.
 	QFile file("/proc/meminfo");
+	if (!file.open(QFile::ReadOnly | QFile::Text))
+		return std::nullopt;
 	QString meminfo = file.readAll();
+	if (!meminfo.contains("MemAvailable:"))
+		return std::nullopt;
 
 	// Parse it.
 	// Algorithm explanation:
 	// "...\nMemAvailable:    12345 kB\n..." -> mid() ->
 	// "    12345 kB" -> chopped() ->
 	// "    12345" -> toULongLong() ->
-	// 12345 -> *1000 ->
-	// 12345000.
+	// 12345 -> *1024 ->
+	// 12641280.
 	auto start = meminfo.indexOf("MemAvailable:") + sizeof "MemAvailable:";
-	return meminfo.mid(
+	bool ok;
+	const unsigned long long available = meminfo.mid(
 		start,
 		meminfo.indexOf('\n', start) - start
-	).chopped(sizeof " kB").toULongLong() * 1000;
+	).chopped(sizeof " kB").trimmed().toULongLong(&ok) * 1024;
+	if (!ok)
+		return std::nullopt;
+
+	// The container may have much less than the host.
+	return std::min(available, cgroup_free_memory());
+}
+
+func::CacheSizes func::cpu_cache_sizes() {
+	CacheSizes result;
+
+	// Every cache of the first core is described in /sys/devices/system/cpu/cpu0/cache/indexN.
+	for (int i = 0; ; i++) {
+		const QString dir = QString("/sys/devices/system/cpu/cpu0/cache/index%1/").arg(i);
+		QFile level_file(dir + "level"), type_file(dir + "type"), size_file(dir + "size");
+		if (!level_file.open(QFile::ReadOnly) || !type_file.open(QFile::ReadOnly) ||
+			!size_file.open(QFile::ReadOnly))
+			break;
+
+		if (QString(type_file.readAll()).trimmed() == "Instruction")
+			continue;
+
+		// Like "1024K".
+		QString size_str = QString(size_file.readAll()).trimmed();
+		unsigned long long multiplier = 1;
+		if (size_str.endsWith('K')) {
+			multiplier = 1024ull;
+			size_str.chop(1);
+		}
+		else if (size_str.endsWith('M')) {
+			multiplier = 1024ull * 1024ull;
+			size_str.chop(1);
+		}
+		const unsigned long long size = size_str.toULongLong() * multiplier;
+
+		const int level = QString(level_file.readAll()).trimmed().toInt();
+		if (level == 2)
+			result.l2 = size;
+		else if (level == 3)
+			result.l3 = size;
+	}
+
+	return result;
 }
 
 #endif
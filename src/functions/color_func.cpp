@@ -0,0 +1,150 @@
+/*
+ * ImageUpscalerQt - color space functions
+ * SPDX-FileCopyrightText: 2021-2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <cassert>
+
+#include "func.hpp"
+
+// Every loop is compiled for AVX-512, AVX2 and the baseline, the best one is chosen
+// at run time (GCC and Clang on x86-64 Linux). Other compilers get the baseline only.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define COLOR_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define COLOR_TARGET_CLONES
+#endif
+
+/// Pixels converted at a time. The channels of a chunk are split into planes,
+/// so the arithmetic is done on whole vectors.
+constexpr int CHUNK_PIXELS = 64;
+/// Smaller images are converted by a single thread.
+constexpr long long PARALLEL_MIN_PIXELS = 256ll * 256ll;
+
+/// out = matrix * in + offset for the first three channels of every pixel.
+struct ColorTransform {
+	float matrix[3][3];
+	float offset[3];
+};
+
+constexpr ColorTransform RGB_TO_YCBCR = {
+	{{0.299f, 0.587f, 0.114f}, {-0.168736f, -0.331264f, 0.5f}, {0.5f, -0.418688f, -0.081312f}},
+	{0.0f, 0.5f, 0.5f}
+};
+// Offsets of the chroma are folded in: y + 1.402 * (cr - 0.5) = y + 1.402 * cr - 0.701.
+constexpr ColorTransform YCBCR_TO_RGB = {
+	{{1.0f, 0.0f, 1.402f}, {1.0f, -0.344136f, -0.714136f}, {1.0f, 1.772f, 0.0f}},
+	{-0.701f, 0.529136f, -0.886f}
+};
+constexpr ColorTransform RGB_TO_YCOCG = {
+	{{0.25f, 0.5f, 0.25f}, {0.5f, 0.0f, -0.5f}, {-0.25f, 0.5f, -0.25f}},
+	{0.0f, 0.5f, 0.5f}
+};
+constexpr ColorTransform YCOCG_TO_RGB = {
+	{{1.0f, 1.0f, -1.0f}, {1.0f, 0.0f, 1.0f}, {1.0f, -1.0f, -1.0f}},
+	{0.0f, -0.5f, 1.0f}
+};
+
+/// Convert the pixels of a range. The other channels (alpha and so on) are left as they are.
+/// @tparam CHANNELS Channels of every pixel, 0 if it is known only at run time.
+template<int CHANNELS>
+COLOR_TARGET_CLONES
+void transform_range(float* data, size_t pixels, int channels, const ColorTransform& t) {
+	if constexpr (CHANNELS != 0)
+		channels = CHANNELS;
+
+	alignas(64) float in[3][CHUNK_PIXELS];
+	alignas(64) float out[3][CHUNK_PIXELS];
+
+	for (size_t first = 0; first < pixels; first += CHUNK_PIXELS) {
+		const int count = static_cast<int>(std::min<size_t>(CHUNK_PIXELS, pixels - first));
+		float* chunk = data + first * channels;
+
+		for (int i = 0; i < count; i++) {
+			in[0][i] = chunk[i * channels];
+			in[1][i] = chunk[i * channels + 1];
+			in[2][i] = chunk[i * channels + 2];
+		}
+
+		for (int c = 0; c < 3; c++) {
+			const float m0 = t.matrix[c][0], m1 = t.matrix[c][1], m2 = t.matrix[c][2], o = t.offset[c];
+			for (int i = 0; i < CHUNK_PIXELS; i++)
+				out[c][i] = m0 * in[0][i] + m1 * in[1][i] + m2 * in[2][i] + o;
+		}
+
+		for (int i = 0; i < count; i++) {
+			chunk[i * channels] = out[0][i];
+			chunk[i * channels + 1] = out[1][i];
+			chunk[i * channels + 2] = out[2][i];
+		}
+	}
+}
+
+/// Convert the pixels in place, split into ranges between the threads of the calling thread
+/// (see func::run_restricted).
+void transform(float* data, size_t pixels, int channels, const ColorTransform& t) {
+	assert(channels >= 3);
+
+	const long long ranges = (static_cast<long long>(pixels) + PARALLEL_MIN_PIXELS - 1) / PARALLEL_MIN_PIXELS;
+#pragma omp parallel for schedule(static) if(ranges > 1)
+	for (long long r = 0; r < ranges; r++) {
+		const size_t first = r * PARALLEL_MIN_PIXELS;
+		const size_t count = std::min<size_t>(PARALLEL_MIN_PIXELS, pixels - first);
+		float* range = data + first * channels;
+
+		// Fixed strides let the compiler shuffle instead of loading the channels one by one.
+		if (channels == 3)
+			transform_range<3>(range, count, channels, t);
+		else if (channels == 4)
+			transform_range<4>(range, count, channels, t);
+		else
+			transform_range<0>(range, count, channels, t);
+	}
+}
+
+/// Convert planar pixels of a range.
+COLOR_TARGET_CLONES
+void transform_planes_range(float* p0, float* p1, float* p2, size_t count, const ColorTransform& t) {
+	for (size_t i = 0; i < count; i++) {
+		const float in0 = p0[i], in1 = p1[i], in2 = p2[i];
+		p0[i] = t.matrix[0][0] * in0 + t.matrix[0][1] * in1 + t.matrix[0][2] * in2 + t.offset[0];
+		p1[i] = t.matrix[1][0] * in0 + t.matrix[1][1] * in1 + t.matrix[1][2] * in2 + t.offset[1];
+		p2[i] = t.matrix[2][0] * in0 + t.matrix[2][1] * in1 + t.matrix[2][2] * in2 + t.offset[2];
+	}
+}
+
+/// Convert the planes in place, split into ranges between the threads like transform().
+void transform_planes(float* const planes[3], size_t count, const ColorTransform& t) {
+	const long long ranges = (static_cast<long long>(count) + PARALLEL_MIN_PIXELS - 1) / PARALLEL_MIN_PIXELS;
+#pragma omp parallel for schedule(static) if(ranges > 1)
+	for (long long r = 0; r < ranges; r++) {
+		const size_t first = r * PARALLEL_MIN_PIXELS;
+		transform_planes_range(planes[0] + first, planes[1] + first, planes[2] + first,
+							   std::min<size_t>(PARALLEL_MIN_PIXELS, count - first), t);
+	}
+}
+
+/// Transform of the conversion.
+const ColorTransform& conversion_transform(ColorSpaceConversion conversion) {
+	switch (conversion) {
+	case ColorSpaceConversion::rgb_to_ycbcr:
+		return RGB_TO_YCBCR;
+	case ColorSpaceConversion::ycbcr_to_rgb:
+		return YCBCR_TO_RGB;
+	case ColorSpaceConversion::rgb_to_ycocg:
+		return RGB_TO_YCOCG;
+	case ColorSpaceConversion::ycocg_to_rgb:
+	default:
+		return YCOCG_TO_RGB;
+	}
+}
+
+void func::rgb_to_ycbcr(float* data, size_t pixels, int channels) {
+	transform(data, pixels, channels, RGB_TO_YCBCR);
+}
+
+void func::convert_color_space(ColorSpaceConversion conversion, float* const planes[3], size_t count) {
+	transform_planes(planes, count, conversion_transform(conversion));
+}
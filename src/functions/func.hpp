@@ -7,6 +7,9 @@
 #pragma once
 
 #include <array>
+#include <chrono>
+#include <functional>
+#include <optional>
 #include <vector>
 
 #include <QString>
@@ -32,6 +35,8 @@ namespace func {
 
 	QString bytes_amount_to_string(unsigned long long bytes);
 	QString pixel_amount_to_string(unsigned long long pixels);
+	/// "12.34 GFLOP" or "5.67 MFLOP" for the amount of arithmetic operations.
+	QString operations_amount_to_string(unsigned long long operations);
 	QString milliseconds_to_string(unsigned long long millis);
 
 	QString shorten_file_path(const QString& orig);
@@ -42,10 +47,13 @@ namespace func {
 
 	// BEGIN Calculation functions
 	/// How many blocks (block_size) will fit in the full image (full_size).
-	int blocks_amount(const QSize full_size, const QSize block_size, const int block_margin = 0);
+	int blocks_amount(const QSize full_size, const QSize block_size);
 
 	unsigned long long srcnn_operations_amount(SRCNNDesc desc, QSize size);
 	unsigned long long fsrcnn_operations_amount(FSRCNNDesc desc, QSize size);
+	/// APPROXIMATE amount of arithmetic operations of the task on an image of the size.
+	/// @param channels Channels of the image.
+	unsigned long long task_operations_amount(const TaskDesc& desc, QSize size, int channels);
 
 	/// Predict the APPROXIMATE memory consumption of tensors that going throught the CNN.
 	/// @returns Amount of bytes that will consumed.
@@ -60,8 +68,89 @@ namespace func {
 	unsigned long long predict_cnn_memory_consumption(std::vector<unsigned short> channels,
 													  std::vector<QSize> sizes);
 
-	/// Get free physical memory in bytes.
-	unsigned long long free_physical_memory();
+	/// Get free physical memory in bytes. On Linux, the memory left to the cgroup (v2) of the process
+	/// and its parents is taken into account, so the containers are not overcommitted.
+	/// @returns std::nullopt if it can't be read. 0 means that there is really no free memory.
+	std::optional<unsigned long long> free_physical_memory();
+
+	struct CacheSizes {
+		/// L2 cache of one core in bytes, 0 if unknown.
+		unsigned long long l2 = 0;
+		/// L3 cache of the whole CPU in bytes, 0 if unknown.
+		unsigned long long l3 = 0;
+	};
+
+	/// Sizes of the data caches of the CPU.
+	CacheSizes cpu_cache_sizes();
+
+	/// Choose the block size of the neural network for the image: activations of a block
+	/// (with its halo) must fit in the cache share of one core (blocks of a minibatch
+	/// are processed by different cores), but the halo must not take too much computations.
+	/// @returns 0 if the image should not be split.
+	int auto_block_size(const SRCNNDesc& desc, QSize image_size);
+	int auto_block_size(const FSRCNNDesc& desc, QSize image_size);
+
+	/// How a neural network task splits an image into blocks and minibatches.
+	struct CNNBlocks {
+		/// 0 if the image is not split.
+		int block_size = 0;
+		/// Block with its halo, clipped by the image.
+		QSize window;
+		/// Blocks in one execution. Every channel of a block is a separate item of the minibatch.
+		int blocks_per_batch = 1;
+		/// APPROXIMATE memory consumption of the tensors of one execution in bytes.
+		unsigned long long memory = 0;
+	};
+
+	/// Split the image into blocks for the neural network. Small blocks are batched together,
+	/// so oneDNN gets bigger convolutions.
+	/// @param block_size Block size of the task: 0 for the whole image or AUTO_BLOCK_SIZE.
+	/// @param channels Channels of the image that go through the network.
+	/// @param memory_limit If not 0, the blocks and the minibatches are reduced, so one execution
+	/// takes at most this amount of bytes (blocks are not made smaller than 16).
+	CNNBlocks cnn_blocks(const SRCNNDesc& desc, QSize image_size, int block_size, int channels,
+						 unsigned long long memory_limit = 0);
+	CNNBlocks cnn_blocks(const FSRCNNDesc& desc, QSize image_size, int block_size, int channels,
+						 unsigned long long memory_limit = 0);
 
 	// END Calculation functions
+
+	// BEGIN Threading functions
+	/// Logical CPUs the process may run on: its affinity mask, which taskset or a container cpuset may narrow.
+	/// At least one.
+	std::vector<int> allowed_cpus();
+	/// Amount of the allowed CPUs (see allowed_cpus()), at least 1.
+	int hardware_threads();
+
+	/// Pin the calling thread to the CPUs and run the function in it, with the threads of oneDNN limited
+	/// to the amount of the CPUs: the OpenMP team started from the thread, or a TBB arena of that concurrency.
+	void run_restricted(const std::vector<int>& cpus, const std::function<void()>& function);
+
+	/// Milliseconds elapsed since the time point.
+	double elapsed_ms(std::chrono::steady_clock::time_point start);
+	// END Threading functions
+
+	// BEGIN Color space functions
+	/// Convert the first three planes of the image in place, the other planes are left as they are.
+	/// Vectorized and split between the threads allowed to the calling thread.
+	/// @param count Amount of floats in every plane.
+	void convert_color_space(ColorSpaceConversion conversion, float* const planes[3], size_t count);
+	/// The same for the interleaved pixels, only for the calibration tool that works on OpenImageIO buffers.
+	/// @param data Interleaved pixels.
+	/// @param pixels Amount of pixels.
+	/// @param channels Amount of channels of every pixel, at least 3.
+	void rgb_to_ycbcr(float* data, size_t pixels, int channels = 3);
+	// END Color space functions
+
+	// BEGIN Resampling functions
+	/// Whether resample() supports the interpolation: bilinear, box, B-spline, Catmull-Rom, Mitchell and Lanczos3.
+	/// The other interpolations are left to OpenImageIO.
+	bool native_resampling(Interpolation interpolation);
+	/// Resize a plane like OpenImageIO::ImageBufAlgo::resize() does (resample() for bilinear): the filters are
+	/// stretched when reducing and the edge pixels are repeated. Separable passes with precomputed weights,
+	/// vectorized and split between the threads allowed to the calling thread.
+	/// @param src_stride, dest_stride Distance between the rows in floats.
+	void resample(const float* src, int src_width, int src_height, size_t src_stride,
+				  float* dest, int dest_width, int dest_height, size_t dest_stride, Interpolation interpolation);
+	// END Resampling functions
 }
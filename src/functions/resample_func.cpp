@@ -0,0 +1,241 @@
+/*
+ * ImageUpscalerQt - resampling functions
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+#include "func.hpp"
+
+// The passes are compiled for AVX-512, AVX2 and the baseline, the best one is chosen
+// at run time (GCC and Clang on x86-64 Linux). Other compilers get the baseline only.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define RESAMPLE_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define RESAMPLE_TARGET_CLONES
+#endif
+
+/// Filter of the resampling with the support radius in the source pixels when enlarging.
+/// Reducing stretches the filter by the ratio, like OpenImageIO does.
+struct ResampleFilter {
+	float (*weight)(float x);
+	float radius;
+};
+
+float box_filter(float x) {
+	return std::abs(x) <= 0.5f ? 1.0f : 0.0f;
+}
+
+float b_spline_filter(float x) {
+	x = std::abs(x);
+	if (x >= 2.0f)
+		return 0.0f;
+	if (x < 1.0f)
+		return (3.0f * x * x * x - 6.0f * x * x + 4.0f) / 6.0f;
+	const float t = 2.0f - x;
+	return t * t * t / 6.0f;
+}
+
+float catmull_rom_filter(float x) {
+	x = std::abs(x);
+	if (x >= 2.0f)
+		return 0.0f;
+	if (x < 1.0f)
+		return (3.0f * x * x * x - 5.0f * x * x + 2.0f) * 0.5f;
+	return (-x * x * x + 5.0f * x * x - 8.0f * x + 4.0f) * 0.5f;
+}
+
+/// Mitchell-Netravali with B = C = 1/3.
+float mitchell_filter(float x) {
+	constexpr float b = 1.0f / 3.0f;
+	constexpr float c = 1.0f / 3.0f;
+	x = std::abs(x);
+	if (x >= 2.0f)
+		return 0.0f;
+	if (x < 1.0f)
+		return ((12.0f - 9.0f * b - 6.0f * c) * x * x * x + (-18.0f + 12.0f * b + 6.0f * c) * x * x +
+				(6.0f - 2.0f * b)) / 6.0f;
+	return ((-b - 6.0f * c) * x * x * x + (6.0f * b + 30.0f * c) * x * x + (-12.0f * b - 48.0f * c) * x +
+			(8.0f * b + 24.0f * c)) / 6.0f;
+}
+
+float lanczos3_filter(float x) {
+	x = std::abs(x);
+	if (x >= 3.0f)
+		return 0.0f;
+	if (x < 0.0001f)
+		return 1.0f;
+	const float pix = std::numbers::pi_v<float> * x;
+	return 3.0f * std::sin(pix) * std::sin(pix / 3.0f) / (pix * pix);
+}
+
+/// Filter of the interpolation, nullptr weight if it is not supported natively.
+/// Bilinear is a plain interpolation and is not described by a filter.
+ResampleFilter resample_filter(Interpolation interpolation) {
+	switch (interpolation) {
+	case Interpolation::box:
+		return {box_filter, 0.5f};
+	case Interpolation::b_spline:
+		return {b_spline_filter, 2.0f};
+	case Interpolation::catmull_rom:
+		return {catmull_rom_filter, 2.0f};
+	case Interpolation::mitchell:
+		return {mitchell_filter, 2.0f};
+	case Interpolation::lanczos3:
+		return {lanczos3_filter, 3.0f};
+	default:
+		return {nullptr, 0.0f};
+	}
+}
+
+/// Weights of the source pixels of every output pixel along one axis. The source pixels of an output
+/// are [first, first + taps), the pixels beyond the image edges are clamped into it (their weights are added
+/// to the edge pixels), like the clamp wrap mode of OpenImageIO, so the passes never check the bounds.
+struct ResampleTable {
+	int taps = 0;
+	std::vector<int> first;
+	std::vector<float> weights;
+};
+
+/// Table of the axis with the same pixel centers as OpenImageIO: the output pixel x samples the source at
+/// (x + 0.5) * src_size / dest_size. The positions and the filter arguments are computed in the same order
+/// of the float operations as in OpenImageIO, because the box filter is cut right at the pixel centers
+/// when reducing, and a different rounding takes another pixel.
+ResampleTable resample_table(int src_size, int dest_size, Interpolation interpolation) {
+	const float ratio = static_cast<float>(dest_size) / src_size;
+	const float dest_pixel_size = 1.0f / dest_size;
+	ResampleTable table;
+
+	if (interpolation == Interpolation::bilinear) {
+		table.taps = std::min(2, src_size);
+		table.first.resize(dest_size);
+		table.weights.assign(static_cast<size_t>(dest_size) * table.taps, 0.0f);
+		for (int x = 0; x < dest_size; x++) {
+			const float center = (x + 0.5f) * dest_pixel_size * src_size - 0.5f;
+			const int left = static_cast<int>(std::floor(center));
+			const float frac = center - left;
+			const int first = std::clamp(left, 0, src_size - table.taps);
+			table.first[x] = first;
+			float* weights = table.weights.data() + static_cast<size_t>(x) * table.taps;
+			weights[std::clamp(left, 0, src_size - 1) - first] += 1.0f - frac;
+			weights[std::clamp(left + 1, 0, src_size - 1) - first] += frac;
+		}
+		return table;
+	}
+
+	const ResampleFilter filter = resample_filter(interpolation);
+	assert(filter.weight != nullptr);
+	// Reducing stretches the filter, so every source pixel contributes.
+	const float scale = std::min(ratio, 1.0f);
+	const float radius = filter.radius / scale;
+	const int radius_taps = static_cast<int>(std::ceil(radius));
+	const int unclamped_taps = radius_taps * 2 + 1;
+	table.taps = std::min(unclamped_taps, src_size);
+	table.first.resize(dest_size);
+	table.weights.assign(static_cast<size_t>(dest_size) * table.taps, 0.0f);
+
+	for (int x = 0; x < dest_size; x++) {
+		const float center = (x + 0.5f) * dest_pixel_size * src_size;
+		const float center_pixel = std::floor(center);
+		const float center_offset = center - center_pixel - 0.5f;
+		const int left = static_cast<int>(center_pixel) - radius_taps;
+		const int first = std::clamp(left, 0, src_size - table.taps);
+		table.first[x] = first;
+
+		float* weights = table.weights.data() + static_cast<size_t>(x) * table.taps;
+		float sum = 0.0f;
+		for (int i = left; i < left + unclamped_taps; i++) {
+			const float weight = filter.weight(scale * (static_cast<float>(i - left - radius_taps) - center_offset));
+			weights[std::clamp(i, 0, src_size - 1) - first] += weight;
+			sum += weight;
+		}
+
+		// The nearest pixel if the filter doesn't cover any pixel center (the box when reducing by little).
+		if (sum == 0.0f) {
+			weights[std::clamp(static_cast<int>(center), 0, src_size - 1) - first] = 1.0f;
+			continue;
+		}
+		for (int t = 0; t < table.taps; t++)
+			weights[t] /= sum;
+	}
+
+	return table;
+}
+
+/// Resample the rows [ybegin, yend) horizontally.
+RESAMPLE_TARGET_CLONES
+void horizontal_pass(const float* src, size_t src_stride, float* dest, size_t dest_stride, int dest_width,
+					 int ybegin, int yend, const ResampleTable& table) {
+	const int taps = table.taps;
+	for (int y = ybegin; y < yend; y++) {
+		const float* src_row = src + src_stride * y;
+		float* dest_row = dest + dest_stride * y;
+		for (int x = 0; x < dest_width; x++) {
+			const float* pixels = src_row + table.first[x];
+			const float* weights = table.weights.data() + static_cast<size_t>(x) * taps;
+			float sum = 0.0f;
+			for (int t = 0; t < taps; t++)
+				sum += weights[t] * pixels[t];
+			dest_row[x] = sum;
+		}
+	}
+}
+
+/// Resample the output rows [ybegin, yend) vertically. Whole rows are weighted and added, so the loop
+/// over the pixels of a row is vectorized.
+RESAMPLE_TARGET_CLONES
+void vertical_pass(const float* src, size_t src_stride, float* dest, size_t dest_stride, int width,
+				   int ybegin, int yend, const ResampleTable& table) {
+	const int taps = table.taps;
+	for (int y = ybegin; y < yend; y++) {
+		float* dest_row = dest + dest_stride * y;
+		const float* weights = table.weights.data() + static_cast<size_t>(y) * taps;
+		const float* first_row = src + src_stride * table.first[y];
+
+		const float w0 = weights[0];
+		for (int x = 0; x < width; x++)
+			dest_row[x] = w0 * first_row[x];
+		for (int t = 1; t < taps; t++) {
+			const float w = weights[t];
+			const float* src_row = first_row + src_stride * t;
+			for (int x = 0; x < width; x++)
+				dest_row[x] += w * src_row[x];
+		}
+	}
+}
+
+/// Rows of a pass processed by one thread at a time.
+constexpr int PASS_ROWS = 16;
+
+bool func::native_resampling(Interpolation interpolation) {
+	return interpolation == Interpolation::bilinear || resample_filter(interpolation).weight != nullptr;
+}
+
+void func::resample(const float* src, int src_width, int src_height, size_t src_stride,
+					float* dest, int dest_width, int dest_height, size_t dest_stride, Interpolation interpolation) {
+	assert(native_resampling(interpolation));
+
+	const ResampleTable columns = resample_table(src_width, dest_width, interpolation);
+	const ResampleTable rows = resample_table(src_height, dest_height, interpolation);
+
+	// Horizontal pass into the intermediate rows, then the vertical pass into the destination.
+	std::vector<float> intermediate(static_cast<size_t>(dest_width) * src_height);
+	const int src_chunks = (src_height + PASS_ROWS - 1) / PASS_ROWS;
+#pragma omp parallel for schedule(static) if(src_chunks > 1)
+	for (int chunk = 0; chunk < src_chunks; chunk++) {
+		horizontal_pass(src, src_stride, intermediate.data(), dest_width, dest_width,
+						chunk * PASS_ROWS, std::min((chunk + 1) * PASS_ROWS, src_height), columns);
+	}
+
+	const int dest_chunks = (dest_height + PASS_ROWS - 1) / PASS_ROWS;
+#pragma omp parallel for schedule(static) if(dest_chunks > 1)
+	for (int chunk = 0; chunk < dest_chunks; chunk++) {
+		vertical_pass(intermediate.data(), dest_width, dest, dest_stride, dest_width,
+					  chunk * PASS_ROWS, std::min((chunk + 1) * PASS_ROWS, dest_height), rows);
+	}
+}
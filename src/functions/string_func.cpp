@@ -110,6 +110,13 @@ QString func::pixel_amount_to_string(unsigned long long pixels) {
 	}
 }
 
+QString func::operations_amount_to_string(unsigned long long operations) {
+	if (operations < 1'000'000'000ull)
+		return QString::number(operations / 1'000'000.0l, 'f', 2) + " MFLOP";
+	else
+		return QString::number(operations / 1'000'000'000.0l, 'f', 2) + " GFLOP";
+}
+
 QString func::milliseconds_to_string(unsigned long long millis) {
 	auto hours = millis / (1000ull * 60ull * 60ull);
 	auto minutes = millis / (1000ull * 60ull) % 60ull;
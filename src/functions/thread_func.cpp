@@ -0,0 +1,108 @@
+/*
+ * ImageUpscalerQt - threading functions
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <thread>
+
+#include <dnnl_config.h>
+
+#include "func.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if DNNL_CPU_RUNTIME == DNNL_RUNTIME_TBB
+#include <tbb/task_arena.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+std::vector<int> func::allowed_cpus() {
+	std::vector<int> result;
+
+#ifdef Q_OS_LINUX
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &set))
+				result.push_back(i);
+		}
+	}
+#endif
+
+#ifdef Q_OS_WIN
+	DWORD_PTR process_mask, system_mask;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+		for (int i = 0; i < sizeof(DWORD_PTR) * 8; i++) {
+			if (process_mask & (static_cast<DWORD_PTR>(1) << i))
+				result.push_back(i);
+		}
+	}
+#endif
+
+	// All CPUs if the mask is unknown.
+	if (result.empty()) {
+		const int cpus = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		for (int i = 0; i < cpus; i++)
+			result.push_back(i);
+	}
+	return result;
+}
+
+int func::hardware_threads() {
+	return static_cast<int>(allowed_cpus().size());
+}
+
+void func::run_restricted(const std::vector<int>& cpus, const std::function<void()>& function) {
+	// Pin the thread. Threads created by it later (the OpenMP team of oneDNN) inherit the mask.
+#ifdef Q_OS_LINUX
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+	if (CPU_COUNT(&set) != 0)
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+
+#ifdef Q_OS_WIN
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus) {
+		if (cpu < sizeof(DWORD_PTR) * 8)
+			mask |= static_cast<DWORD_PTR>(1) << cpu;
+	}
+	if (mask != 0)
+		SetThreadAffinityMask(GetCurrentThread(), mask);
+#endif
+
+	const int threads = std::max<int>(cpus.size(), 1);
+#ifdef _OPENMP
+	// Limit the OpenMP teams started from this thread: the ones of oneDNN and of the own passes.
+	omp_set_num_threads(threads);
+#endif
+
+#if DNNL_CPU_RUNTIME == DNNL_RUNTIME_TBB
+	// TBB workers don't inherit the mask, oneDNN runs the primitives in the arena of the calling thread.
+	tbb::task_arena arena(threads);
+	arena.execute(function);
+#else
+	function();
+#endif
+}
+
+double func::elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -10,6 +10,8 @@
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
+	// Resources are compiled into the static core library.
+	Q_INIT_RESOURCE(resources);
 
 	// Disable the context help button globally.
 	QApplication::setAttribute(Qt::AA_DisableWindowContextHelpButton);
@@ -0,0 +1,131 @@
+/*
+ * ImageUpscalerQt - model store
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdexcept>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QResource>
+#include <QStandardPaths>
+
+#include "ModelStore.hpp"
+
+/// Embedded models are a separate resource file of the core library.
+void init_models_resource() {
+#ifdef IMAGEUPSCALERQT_EMBED_MODELS
+	Q_INIT_RESOURCE(models);
+#endif
+}
+
+ModelFile::ModelFile(const QString& path) : file(path) {
+	// Uncompressed resources are already in memory, right in the executable.
+	if (path.startsWith(":/")) {
+		QResource resource(path);
+		if (!resource.isValid())
+			throw std::runtime_error("Can't open the model \"" + path.toStdString() + "\".");
+
+		if (!resource.isCompressed()) {
+			data_ptr = reinterpret_cast<const char*>(resource.data());
+			data_size = resource.size();
+			return;
+		}
+	}
+
+	if (!file.open(QFile::ReadOnly))
+		throw std::runtime_error("Can't open the model \"" + path.toStdString() + "\".");
+
+	// The mapping lives while the file is open.
+	if (!path.startsWith(":/") && file.size() != 0) {
+		if (const uchar* mapped = file.map(0, file.size())) {
+			data_ptr = reinterpret_cast<const char*>(mapped);
+			data_size = file.size();
+			return;
+		}
+	}
+
+	copy = file.readAll();
+	file.close();
+	data_ptr = copy.constData();
+	data_size = copy.size();
+}
+
+ModelStore::ModelStore() {
+	init_models_resource();
+}
+
+ModelStore& ModelStore::instance() {
+	static ModelStore store;
+	return store;
+}
+
+std::shared_ptr<const ModelFile> ModelStore::open(const QString& path) {
+	const std::string key = path.toStdString();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (auto cached = files[key].lock())
+			return cached;
+	}
+
+	// Open without the lock, reading a compressed resource takes time.
+	auto result = std::make_shared<const ModelFile>(path);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (auto cached = files[key].lock())
+		return cached;
+	files[key] = result;
+	return result;
+}
+
+QString ModelStore::model_path(const QString& kind, const QString& file_name) const {
+	for (const QString& dir : models_dirs()) {
+		const QString path = dir + "/" + kind + "/" + file_name;
+		if (QFile::exists(path))
+			return path;
+	}
+
+	return ":/" + kind + "/" + file_name;
+}
+
+bool ModelStore::has_model(const QString& kind, const QString& file_name) const {
+	return QFile::exists(model_path(kind, file_name));
+}
+
+QString ModelStore::network_model_path(const QString& kind, const QString& desc) const {
+	const QString container_path = model_path(kind, desc + ".ium");
+	if (QFile::exists(container_path))
+		return container_path;
+
+	return model_path(kind, desc + ".bin");
+}
+
+QStringList ModelStore::model_names(const QString& kind) const {
+	QStringList result;
+	QStringList dirs = models_dirs();
+	dirs.push_back(":");
+
+	for (const QString& dir : dirs)
+		result += QDir(dir + "/" + kind).entryList(QDir::Files);
+
+	result.removeDuplicates();
+	return result;
+}
+
+QStringList ModelStore::models_dirs() {
+	// Next to the executable (relocatable installations and Windows), then the system data folders.
+	QStringList result;
+	const QString app_dir = QDir(QCoreApplication::applicationDirPath() + "/../share/ImageUpscalerQt/models").absolutePath();
+	if (QDir(app_dir).exists())
+		result.push_back(app_dir);
+
+	for (const QString& dir : QStandardPaths::locateAll(QStandardPaths::GenericDataLocation,
+														"ImageUpscalerQt/models", QStandardPaths::LocateDirectory)) {
+		if (!result.contains(dir))
+			result.push_back(dir);
+	}
+
+	return result;
+}
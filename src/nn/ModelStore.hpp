@@ -0,0 +1,80 @@
+/*
+ * ImageUpscalerQt - model store header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+/// Read-only contents of a model file. Files and uncompressed resources are used in place
+/// (memory-mapped or directly in the executable), everything else is read into memory.
+class ModelFile {
+public:
+	/// @throws std::runtime_error if the file can't be opened.
+	explicit ModelFile(const QString& path);
+
+	ModelFile(const ModelFile&) = delete;
+	ModelFile& operator=(const ModelFile&) = delete;
+
+	const char* data() const {
+		return data_ptr;
+	}
+
+	size_t size() const {
+		return data_size;
+	}
+
+	/// Whether the contents are not copied (mapped file or uncompressed resource).
+	bool is_mapped() const {
+		return copy.isEmpty();
+	}
+
+private:
+	QFile file;
+	/// Contents of compressed resources and of files that can't be mapped.
+	QByteArray copy;
+	const char* data_ptr = nullptr;
+	size_t data_size = 0;
+};
+
+/// Process-wide store of the model files. A file is opened once and shared between all networks
+/// (and all tasks and concurrent images) while any of them uses it.
+/// Models are looked for in the installed models folders first, then in the resources.
+class ModelStore {
+public:
+	static ModelStore& instance();
+
+	/// Contents of the model file. The pointer keeps it open.
+	/// @throws std::runtime_error if the file can't be opened.
+	std::shared_ptr<const ModelFile> open(const QString& path);
+
+	/// Path of the model file ("srcnn" or "fsrcnn" kind, file name like "9-3-5 64-32.bin"):
+	/// in an installed models folder if it is there, in the resources otherwise. The file may not exist.
+	QString model_path(const QString& kind, const QString& file_name) const;
+	/// Whether the model file exists in the models folders or in the resources.
+	bool has_model(const QString& kind, const QString& file_name) const;
+	/// Path of the f32 model of the network (desc like "9-3-5 64-32"): the model container (".ium")
+	/// if there is one, the raw parameters (".bin") otherwise. The file may not exist.
+	QString network_model_path(const QString& kind, const QString& desc) const;
+	/// File names of all models of the kind, without duplicates.
+	QStringList model_names(const QString& kind) const;
+
+	/// Installed models folders, like "/usr/share/ImageUpscalerQt/models".
+	static QStringList models_dirs();
+
+private:
+	std::mutex mutex;
+	std::map<std::string, std::weak_ptr<const ModelFile>> files;
+
+	ModelStore();
+};
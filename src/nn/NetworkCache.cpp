@@ -0,0 +1,225 @@
+/*
+ * ImageUpscalerQt - neural network cache
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QFile>
+#include <QStandardPaths>
+
+#include "NetworkCache.hpp"
+#include "ModelStore.hpp"
+
+/// Key of a network in the cache: "srcnn 9-3-5 64-32 256x256x3 f32" (3 is the minibatch size).
+std::string network_key(const char* kind, const QString& desc, QSize size, int batch, Precision precision) {
+	return QString("%1 %2 %3x%4x%5 %6").arg(kind, desc, QString::number(size.width()),
+		QString::number(size.height()), QString::number(batch),
+		PRECISION_NAMES[static_cast<unsigned char>(precision)]).toStdString();
+}
+
+/// oneDNN data type of the precision.
+dnnl::memory::data_type precision_data_type(Precision precision) {
+	switch (precision) {
+	case Precision::bf16:
+		return dnnl::memory::data_type::bf16;
+	case Precision::int8:
+		return dnnl::memory::data_type::s8;
+	case Precision::f32:
+	default:
+		return dnnl::memory::data_type::f32;
+	}
+}
+
+/// Path of the model file of the network for the precision.
+/// @throws std::runtime_error if there is no quantized model for int8.
+QString model_path(const QString& kind, const QString& desc, Precision precision) {
+	if (precision != Precision::int8)
+		return ModelStore::instance().network_model_path(kind, desc);
+
+	const QString path = NetworkCache::quantized_model_path(kind, desc);
+	if (!QFile::exists(path)) {
+		throw std::runtime_error(QString("There is no int8 model of the %1 %2. "
+			"Create it with imageupscalerqt-calibrate.").arg(kind.toUpper(), desc).toStdString());
+	}
+
+	return path;
+}
+
+/// Scales of the model for the int8 precision, empty for the others.
+QuantizationScales model_scales(const QString& path, Precision precision) {
+	return precision == Precision::int8 ? NetworkParams::load_scales(path) : QuantizationScales();
+}
+
+NetworkCache::NetworkCache() : eng(dnnl::engine::kind::cpu, 0) {}
+
+NetworkCache& NetworkCache::instance() {
+	static NetworkCache cache;
+	return cache;
+}
+
+std::shared_ptr<SRCNN> NetworkCache::acquire_srcnn(const SRCNNDesc& desc, QSize size, int batch,
+												  Precision precision) {
+	precision = effective_precision(precision);
+	const std::string key = network_key("srcnn", desc.to_string(), size, batch, precision);
+
+	auto nn = take_idle(idle_srcnns, key);
+	if (nn == nullptr) {
+		const QString path = model_path("srcnn", desc.to_string(), precision);
+		nn = std::make_unique<SRCNN>(size.width(), size.height(), batch, desc, eng,
+									  precision_data_type(precision), model_scales(path, precision));
+		const auto ker_descs = nn->get_ker_descs();
+		const auto bias_descs = nn->get_bias_descs();
+		const auto prim_ker_descs = nn->get_prim_ker_descs();
+		nn->set_params(get_params(path, TaskKind::srcnn, 1, precision == Precision::int8,
+			std::vector<dnnl::memory::desc>(ker_descs.begin(), ker_descs.end()),
+			std::vector<dnnl::memory::desc>(bias_descs.begin(), bias_descs.end()),
+			std::vector<dnnl::memory::desc>(prim_ker_descs.begin(), prim_ker_descs.end())));
+	}
+
+	return lease(idle_srcnns, key, std::move(nn));
+}
+
+std::shared_ptr<FSRCNN> NetworkCache::acquire_fsrcnn(const FSRCNNDesc& desc, QSize size, int batch,
+												  Precision precision) {
+	precision = effective_precision(precision);
+	const std::string key = network_key("fsrcnn", desc.to_string(), size, batch, precision);
+
+	auto nn = take_idle(idle_fsrcnns, key);
+	if (nn == nullptr) {
+		const QString path = model_path("fsrcnn", desc.to_string(), precision);
+		nn = std::make_unique<FSRCNN>(size.width(), size.height(), batch, desc, eng,
+									  precision_data_type(precision), model_scales(path, precision));
+		nn->set_params(get_params(path, TaskKind::fsrcnn, desc.size_multiplier, precision == Precision::int8,
+								  nn->get_ker_descs(), nn->get_bias_descs(), nn->get_prim_ker_descs()));
+	}
+
+	return lease(idle_fsrcnns, key, std::move(nn));
+}
+
+Precision NetworkCache::effective_precision(Precision precision) {
+	if (precision == Precision::bf16) {
+		// The ISAs are bit masks that include the bits of the ISAs they extend, so every ISA with bf16
+		// (AMX and the later ones) has all bits of avx512_core_bf16. Not a comparison: avx2_vnni is greater.
+		const auto isa = static_cast<unsigned int>(dnnl::get_effective_cpu_isa());
+		const auto bf16_isa = static_cast<unsigned int>(dnnl::cpu_isa::avx512_core_bf16);
+		if ((isa & bf16_isa) != bf16_isa)
+			return Precision::f32;
+	}
+
+	return precision;
+}
+
+QString NetworkCache::quantized_model_path(const QString& kind, const QString& desc) {
+	// A model container like the f32 ones, named apart from them because both may be in one folder.
+	const QString file_name = desc + ".int8.ium";
+	const QString bundled_path = ModelStore::instance().model_path(kind, file_name);
+	if (QFile::exists(bundled_path))
+		return bundled_path;
+
+	return user_models_dir() + "/" + kind + "/" + file_name;
+}
+
+QString NetworkCache::user_models_dir() {
+	// Not AppDataLocation, it depends on the name of the executable.
+	return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/ImageUpscalerQt";
+}
+
+NetworkCache::Stats NetworkCache::get_stats() const {
+	Stats stats;
+	stats.network_hits = network_hits;
+	stats.network_misses = network_misses;
+	stats.params_hits = params_hits;
+	stats.params_misses = params_misses;
+	return stats;
+}
+
+void NetworkCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	idle_srcnns.clear();
+	idle_fsrcnns.clear();
+	params.clear();
+}
+
+std::shared_ptr<const NetworkParams> NetworkCache::get_params(const QString& path, TaskKind kind,
+		unsigned int size_multiplier, bool quantized,
+		const std::vector<dnnl::memory::desc>& ker_descs,
+		const std::vector<dnnl::memory::desc>& bias_descs,
+		const std::vector<dnnl::memory::desc>& prim_ker_descs) {
+	const std::string key = path.toStdString();
+
+	// Parameters of one file can be cached in several layouts.
+	const auto find_cached = [&]() -> std::shared_ptr<const NetworkParams> {
+		for (const auto& weak : params[key]) {
+			auto cached = weak.lock();
+			if (cached != nullptr && cached->has_kernel_descs(prim_ker_descs))
+				return cached;
+		}
+		return nullptr;
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (auto result = find_cached()) {
+			params_hits++;
+			return result;
+		}
+	}
+
+	// Load and reorder without the lock, it takes time. Two threads may load the same
+	// parameters at once, then the first ones stay in the cache.
+	std::shared_ptr<const NetworkParams> result = NetworkParams::load(path, kind, size_multiplier, quantized,
+		ker_descs, bias_descs, eng);
+	if (!result->has_kernel_descs(prim_ker_descs))
+		result = result->reordered(prim_ker_descs, eng);
+	params_misses++;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (auto existing = find_cached())
+		return existing;
+
+	// Forget the expired parameters.
+	auto& cached_list = params[key];
+	cached_list.erase(std::remove_if(cached_list.begin(), cached_list.end(),
+		[](const std::weak_ptr<const NetworkParams>& weak) { return weak.expired(); }), cached_list.end());
+	cached_list.push_back(result);
+	return result;
+}
+
+template<typename Network>
+std::unique_ptr<Network> NetworkCache::take_idle(IdleList<Network>& list, const std::string& key) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto iter = list.begin(); iter != list.end(); iter++) {
+		if (iter->first == key) {
+			auto result = std::move(iter->second);
+			list.erase(iter);
+			network_hits++;
+			return result;
+		}
+	}
+
+	network_misses++;
+	return nullptr;
+}
+
+template<typename Network>
+std::shared_ptr<Network> NetworkCache::lease(IdleList<Network>& list, const std::string& key,
+											 std::unique_ptr<Network> nn) {
+	// Put the network back to the idle list instead of deleting it.
+	return std::shared_ptr<Network>(nn.release(), [this, &list, key](Network* ptr) {
+		std::lock_guard<std::mutex> lock(mutex);
+		list.emplace_front(key, std::unique_ptr<Network>(ptr));
+
+		size_t buffers_size = 0;
+		for (const auto& pair : list)
+			buffers_size += pair.second->get_buffers_size();
+
+		while (list.size() > MAX_IDLE_NETWORKS || (list.size() > 1 && buffers_size > MAX_IDLE_BUFFERS_SIZE)) {
+			buffers_size -= list.back().second->get_buffers_size();
+			list.pop_back();
+		}
+	});
+}
@@ -0,0 +1,111 @@
+/*
+ * ImageUpscalerQt - neural network cache header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <QSize>
+#include <QString>
+#include <dnnl.hpp>
+
+#include "SRCNN.hpp"
+#include "FSRCNN.hpp"
+#include "NetworkParams.hpp"
+
+/// Process-wide cache of the built neural networks (primitives) and of theirs parameters
+/// (already reordered into the layouts of the primitives).
+/// Networks are keyed by the architecture, the input size, the minibatch size and the precision, so
+/// images of a batch, tasks with the same network and consecutive runs of a Worker
+/// reuse them instead of building everything again.
+class NetworkCache {
+public:
+	struct Stats {
+		unsigned long long network_hits = 0;
+		unsigned long long network_misses = 0;
+		unsigned long long params_hits = 0;
+		unsigned long long params_misses = 0;
+	};
+
+	static NetworkCache& instance();
+
+	/// Engine shared by all networks.
+	const dnnl::engine& get_engine() const {
+		return eng;
+	}
+
+	/// Take an idle network from the cache or build a new one. Every thread must take its own
+	/// network, it returns to the cache when the last copy of the pointer is destroyed.
+	/// Unsupported precision falls back to f32 (see effective_precision()).
+	/// @throws std::runtime_error if the parameters can't be loaded or there is no int8 model.
+	std::shared_ptr<SRCNN> acquire_srcnn(const SRCNNDesc& desc, QSize size, int batch = 1,
+										 Precision precision = Precision::f32);
+	std::shared_ptr<FSRCNN> acquire_fsrcnn(const FSRCNNDesc& desc, QSize size, int batch = 1,
+										   Precision precision = Precision::f32);
+
+	/// The precision that is really used for the requested one on this CPU.
+	/// bf16 needs native support (AVX512-BF16 or AMX), the emulation is slower than f32.
+	/// int8 is supported everywhere, but needs a quantized model (see quantized_model_path()).
+	static Precision effective_precision(Precision precision);
+
+	/// Path of the int8 model container of the network ("srcnn" or "fsrcnn" kind), like "9-3-5 64-32.int8.ium":
+	/// in the installed models or in the resources if it is bundled, in the user models folder otherwise.
+	/// The file may not exist.
+	static QString quantized_model_path(const QString& kind, const QString& desc);
+	/// Folder of the models created by the user (for example, by the calibrate tool).
+	static QString user_models_dir();
+
+	Stats get_stats() const;
+	/// Destroy the idle networks and the parameters that are not used now.
+	void clear();
+
+private:
+	/// Idle networks of one type, the most recently used are at the front.
+	template<typename Network>
+	using IdleList = std::list<std::pair<std::string, std::unique_ptr<Network>>>;
+
+	/// Maximal amount of idle networks of one type and maximal size of theirs buffers.
+	/// Networks of the least recently used sizes are destroyed when exceeded, but the most recently
+	/// released one is always kept: the next image usually needs the same one, and the larger
+	/// it is (up to the whole image), the longer it takes to create.
+	static constexpr int MAX_IDLE_NETWORKS = 16;
+	static constexpr size_t MAX_IDLE_BUFFERS_SIZE = 512ull * 1024ull * 1024ull;
+
+	dnnl::engine eng;
+
+	mutable std::mutex mutex;
+	IdleList<SRCNN> idle_srcnns;
+	IdleList<FSRCNN> idle_fsrcnns;
+	/// Parameters by the file path, in all layouts that are in use.
+	std::map<std::string, std::vector<std::weak_ptr<const NetworkParams>>> params;
+
+	std::atomic<unsigned long long> network_hits = 0;
+	std::atomic<unsigned long long> network_misses = 0;
+	std::atomic<unsigned long long> params_hits = 0;
+	std::atomic<unsigned long long> params_misses = 0;
+
+	NetworkCache();
+
+	/// Find the loaded parameters in the kernel layouts of the primitives
+	/// or load them (in the file layouts) and reorder once.
+	/// @param kind, size_multiplier, quantized What the model must be (see NetworkParams::load()).
+	std::shared_ptr<const NetworkParams> get_params(const QString& path, TaskKind kind,
+													unsigned int size_multiplier, bool quantized,
+													const std::vector<dnnl::memory::desc>& ker_descs,
+													const std::vector<dnnl::memory::desc>& bias_descs,
+													const std::vector<dnnl::memory::desc>& prim_ker_descs);
+
+	template<typename Network>
+	std::unique_ptr<Network> take_idle(IdleList<Network>& list, const std::string& key);
+	template<typename Network>
+	std::shared_ptr<Network> lease(IdleList<Network>& list, const std::string& key,
+								   std::unique_ptr<Network> nn);
+};
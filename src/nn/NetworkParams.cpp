@@ -0,0 +1,481 @@
+/*
+ * ImageUpscalerQt - neural network parameters
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <QDataStream>
+#include <QFile>
+
+#include "NetworkParams.hpp"
+
+/// Header of the model containers.
+const char CONTAINER_MAGIC[4] = {'I', 'U', 'M', 'C'};
+constexpr quint32 CONTAINER_VERSION = 1;
+/// Offset of the first byte covered by the checksum: after the magic, the version and the checksum.
+constexpr int CONTAINER_CHECKSUM_START = 12;
+/// Alignment of the tensors in the model container.
+constexpr quint64 MODEL_ALIGNMENT = 64;
+/// Maximal absolute value of the quantized kernels and sources (-128 is not used to keep them symmetric).
+constexpr float INT8_MAX_VALUE = 127.0f;
+
+void setup_stream(QDataStream& stream) {
+	stream.setByteOrder(QDataStream::LittleEndian);
+	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+/// CRC-32 (IEEE 802.3) of the data.
+quint32 crc32(const char* data, size_t size) {
+	static const auto table = []() {
+		std::array<quint32, 256> result;
+		for (quint32 i = 0; i < 256; i++) {
+			quint32 c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			result[i] = c;
+		}
+		return result;
+	}();
+
+	quint32 crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFFu] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+/// Version of oneDNN, blocked memory descriptions are valid only in the same version.
+quint32 dnnl_version_code() {
+	const dnnl_version_t* version = dnnl_version();
+	return version->major * 10000 + version->minor * 100 + version->patch;
+}
+
+/// Plain layout of the kernels (oihw) or the biases (x).
+dnnl::memory::desc plain_desc(const dnnl::memory::dims& dims, dnnl::memory::data_type data_type) {
+	return dnnl::memory::desc(dims, data_type, dims.size() == 4 ?
+		dnnl::memory::format_tag::oihw : dnnl::memory::format_tag::x);
+}
+
+/// Kernels or biases of a layer in the model container.
+struct ContainerTensor {
+	dnnl::memory::desc desc;
+	quint64 offset = 0;
+};
+
+/// Everything the model container says about the network.
+struct ContainerHeader {
+	quint32 kind = 0;
+	quint32 size_multiplier = 1;
+	/// Empty if the parameters are f32.
+	QuantizationScales scales;
+	std::vector<ContainerTensor> kernels;
+	std::vector<ContainerTensor> biases;
+};
+
+/// Read a tensor entry of the model container.
+/// @returns false if the entry is damaged or its layout is from another oneDNN version.
+bool read_container_tensor(QDataStream& stream, quint32 dnnl_version, quint64 file_size, ContainerTensor& tensor) {
+	quint32 data_type, ndims;
+	stream >> data_type >> ndims;
+	if (stream.status() != QDataStream::Ok || ndims > DNNL_MAX_NDIMS)
+		return false;
+
+	dnnl::memory::dims dims(ndims);
+	for (auto& dim : dims) {
+		qint64 value;
+		stream >> value;
+		dim = value;
+	}
+
+	quint32 desc_size;
+	stream >> desc_size;
+	if (stream.status() != QDataStream::Ok)
+		return false;
+
+	if (desc_size == 0) {
+		tensor.desc = plain_desc(dims, static_cast<dnnl::memory::data_type>(data_type));
+	}
+	else {
+		dnnl_memory_desc_t raw_desc;
+		if (desc_size != sizeof(raw_desc) || dnnl_version != dnnl_version_code() ||
+			stream.readRawData(reinterpret_cast<char*>(&raw_desc), sizeof(raw_desc)) != sizeof(raw_desc))
+			return false;
+
+		tensor.desc = dnnl::memory::desc(raw_desc);
+		if (tensor.desc.dims() != dims)
+			return false;
+	}
+
+	quint64 size;
+	stream >> tensor.offset >> size;
+	return stream.status() == QDataStream::Ok && size == tensor.desc.get_size() &&
+		tensor.offset <= file_size && size <= file_size - tensor.offset;
+}
+
+/// Read and verify the header of the model container.
+/// @throws std::runtime_error if the container is damaged, has an unsupported version
+/// or has blocked layouts of another oneDNN version.
+ContainerHeader read_container(const QByteArray& file_data, const QString& path) {
+	const auto fail = [&path](const char* reason) {
+		return std::runtime_error("Model \"" + path.toStdString() + "\" " + reason + ".");
+	};
+
+	QDataStream stream(file_data);
+	setup_stream(stream);
+	stream.skipRawData(sizeof(CONTAINER_MAGIC));
+
+	quint32 version, checksum;
+	stream >> version >> checksum;
+	if (stream.status() != QDataStream::Ok || version != CONTAINER_VERSION)
+		throw fail("has an unsupported version");
+	if (crc32(file_data.constData() + CONTAINER_CHECKSUM_START, file_data.size() - CONTAINER_CHECKSUM_START) != checksum)
+		throw fail("is damaged (wrong checksum)");
+
+	ContainerHeader header;
+	quint32 quantized, dnnl_version, layers;
+	stream >> header.kind >> header.size_multiplier >> quantized >> dnnl_version >> layers;
+	if (stream.status() != QDataStream::Ok || layers > 256)
+		throw fail("has a damaged header");
+
+	header.kernels.resize(layers);
+	header.biases.resize(layers);
+	if (quantized) {
+		header.scales.src.resize(layers);
+		header.scales.kernels.resize(layers);
+	}
+
+	for (quint32 i = 0; i < layers; i++) {
+		if (quantized) {
+			quint32 out_channels;
+			stream >> header.scales.src[i] >> out_channels;
+			if (stream.status() != QDataStream::Ok || out_channels > 65536)
+				throw fail("has a damaged header");
+
+			header.scales.kernels[i].resize(out_channels);
+			for (float& scale : header.scales.kernels[i])
+				stream >> scale;
+		}
+
+		if (!read_container_tensor(stream, dnnl_version, file_data.size(), header.kernels[i]) ||
+			!read_container_tensor(stream, dnnl_version, file_data.size(), header.biases[i])) {
+			throw fail(dnnl_version != dnnl_version_code() ?
+				"has blocked layouts of another oneDNN version, convert it again" : "has a damaged header");
+		}
+	}
+
+	return header;
+}
+
+float max_abs_value(const dnnl::memory& mem) {
+	assert(mem.get_desc().data_type() == dnnl::memory::data_type::f32);
+
+	const float* data = static_cast<const float*>(mem.get_data_handle());
+	const size_t size = mem.get_desc().get_size() / sizeof(float);
+	float result = 0.0f;
+	for (size_t i = 0; i < size; i++)
+		result = std::max(result, std::abs(data[i]));
+
+	return result;
+}
+
+std::vector<float> QuantizationScales::output_scales(size_t layer) const {
+	assert(layer < src.size() && layer < kernels.size());
+
+	const float next_scale = layer + 1 < src.size() ? src[layer + 1] : 1.0f;
+	std::vector<float> result(kernels[layer].size());
+	for (size_t i = 0; i < result.size(); i++)
+		result[i] = next_scale / (src[layer] * kernels[layer][i]);
+
+	return result;
+}
+
+std::shared_ptr<NetworkParams> NetworkParams::load(const QString& path, TaskKind kind, unsigned int size_multiplier,
+												   bool quantized,
+												   const std::vector<dnnl::memory::desc>& ker_descs,
+												   const std::vector<dnnl::memory::desc>& bias_descs,
+												   const dnnl::engine& eng) {
+	assert(ker_descs.size() == bias_descs.size());
+	const auto fail = [&path](const char* reason) {
+		return std::runtime_error("Model \"" + path.toStdString() + "\" " + reason + ".");
+	};
+
+	auto result = std::make_shared<NetworkParams>();
+	result->file = ModelStore::instance().open(path);
+	// Wraps the file contents without copying.
+	const QByteArray file_data = QByteArray::fromRawData(result->file->data(), result->file->size());
+	// The memories point right into the file.
+	char* params_data = const_cast<char*>(result->file->data());
+
+	if (file_data.startsWith(QByteArray(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)))) {
+		const ContainerHeader header = read_container(file_data, path);
+		if (header.kind != static_cast<quint32>(kind) || header.size_multiplier != size_multiplier)
+			throw fail("is of another network (task kind or size multiplier)");
+		if (header.scales.empty() == quantized)
+			throw fail(quantized ? "is not quantized, the int8 precision needs a quantized model" :
+								   "is quantized, it can be used only in the int8 precision");
+		result->scales = header.scales;
+
+		// The data types must match the precision, the layouts may be any.
+		const auto ker_data_type = quantized ? dnnl::memory::data_type::s8 : dnnl::memory::data_type::f32;
+		for (size_t i = 0; i < header.kernels.size(); i++) {
+			if (header.kernels[i].desc.data_type() != ker_data_type ||
+				header.biases[i].desc.data_type() != bias_data_type(ker_data_type))
+				throw fail("has parameters of another data type");
+		}
+
+		// The shapes must match the network, the layouts and the data types come from the file.
+		bool matches = header.kernels.size() == ker_descs.size();
+		for (size_t i = 0; matches && i < ker_descs.size(); i++) {
+			matches = header.kernels[i].desc.dims() == ker_descs[i].dims() &&
+				header.biases[i].desc.dims() == bias_descs[i].dims() &&
+				(header.scales.empty() || header.scales.kernels[i].size() == ker_descs[i].dims()[0]);
+		}
+		if (!matches) {
+			throw std::runtime_error("Model \"" + path.toStdString() +
+									 "\" doesn't match the architecture.");
+		}
+
+		// The tensors are aligned within the file, but the file itself may be aligned to less
+		// (the resources embedded into the executable), then its copy is used.
+		if (reinterpret_cast<quintptr>(params_data) % MODEL_ALIGNMENT != 0) {
+			result->data = QByteArray(file_data.size() + MODEL_ALIGNMENT - 1, Qt::Uninitialized);
+			const quintptr address = reinterpret_cast<quintptr>(result->data.data());
+			params_data = result->data.data() + (MODEL_ALIGNMENT - address % MODEL_ALIGNMENT) % MODEL_ALIGNMENT;
+			std::memcpy(params_data, file_data.constData(), file_data.size());
+			result->file = nullptr;
+		}
+
+		result->kernels.resize(ker_descs.size());
+		result->biases.resize(bias_descs.size());
+		for (size_t i = 0; i < ker_descs.size(); i++) {
+			result->kernels[i] = dnnl::memory(header.kernels[i].desc, eng, params_data + header.kernels[i].offset);
+			result->biases[i] = dnnl::memory(header.biases[i].desc, eng, params_data + header.biases[i].offset);
+		}
+
+		return result;
+	}
+
+	// Other files are raw f32 parameters, the quantized ones are always in the containers.
+	if (quantized)
+		throw fail("is not quantized, the int8 precision needs a quantized model");
+
+	size_t total_params_size = 0;
+	for (int i = 0; i < ker_descs.size(); i++)
+		total_params_size += ker_descs[i].get_size() + bias_descs[i].get_size();
+
+	if (file_data.size() != total_params_size)
+		throw std::runtime_error("Neural network parameters \"" + path.toStdString() +
+								 "\" don't match the architecture.");
+
+	result->kernels.resize(ker_descs.size());
+	result->biases.resize(bias_descs.size());
+	size_t mem_offset = 0;
+	for (int i = 0; i < ker_descs.size(); i++) {
+		result->kernels[i] = dnnl::memory(ker_descs[i], eng, params_data + mem_offset);
+		mem_offset += ker_descs[i].get_size();
+		result->biases[i] = dnnl::memory(bias_descs[i], eng, params_data + mem_offset);
+		mem_offset += bias_descs[i].get_size();
+	}
+
+	return result;
+}
+
+QuantizationScales NetworkParams::load_scales(const QString& path) {
+	// The checksum of the container covers the whole file.
+	const auto model = ModelStore::instance().open(path);
+	const QByteArray file_data = QByteArray::fromRawData(model->data(), model->size());
+	if (!file_data.startsWith(QByteArray(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC))))
+		throw std::runtime_error("\"" + path.toStdString() + "\" is not a model container.");
+
+	QuantizationScales result = read_container(file_data, path).scales;
+	if (result.empty())
+		throw std::runtime_error("\"" + path.toStdString() + "\" is not a quantized model.");
+	return result;
+}
+
+std::shared_ptr<NetworkParams> NetworkParams::quantize(const NetworkParams& params,
+													   const std::vector<float>& src_max,
+													   const dnnl::engine& eng) {
+	assert(params.scales.empty() && src_max.size() == params.kernels.size());
+
+	const size_t layers = params.kernels.size();
+	std::vector<dnnl::memory::desc> ker_descs(layers), bias_descs(layers);
+
+	size_t total_params_size = 0;
+	for (size_t i = 0; i < layers; i++) {
+		ker_descs[i] = with_data_type(params.kernels[i].get_desc(), dnnl::memory::data_type::s8);
+		bias_descs[i] = with_data_type(params.biases[i].get_desc(), dnnl::memory::data_type::s32);
+		total_params_size += ker_descs[i].get_size() + bias_descs[i].get_size();
+	}
+
+	auto result = std::make_shared<NetworkParams>();
+	result->data.resize(total_params_size);
+	result->kernels.resize(layers);
+	result->biases.resize(layers);
+	result->scales.src.resize(layers);
+	result->scales.kernels.resize(layers);
+
+	size_t mem_offset = 0;
+	for (size_t i = 0; i < layers; i++) {
+		// Kernels are planar (oihw), every output channel is contiguous.
+		const float* kernel = static_cast<const float*>(params.kernels[i].get_data_handle());
+		const float* bias = static_cast<const float*>(params.biases[i].get_data_handle());
+		const auto dims = ker_descs[i].dims();
+		const size_t out_channels = dims[0];
+		const size_t channel_size = dims[1] * dims[2] * dims[3];
+
+		float& src_scale = result->scales.src[i];
+		src_scale = src_max[i] > 0.0f ? INT8_MAX_VALUE / src_max[i] : 1.0f;
+
+		auto q_kernel = reinterpret_cast<std::int8_t*>(result->data.data() + mem_offset);
+		result->kernels[i] = dnnl::memory(ker_descs[i], eng, q_kernel);
+		mem_offset += ker_descs[i].get_size();
+		auto q_bias = reinterpret_cast<std::int32_t*>(result->data.data() + mem_offset);
+		result->biases[i] = dnnl::memory(bias_descs[i], eng, q_bias);
+		mem_offset += bias_descs[i].get_size();
+
+		// Symmetric quantization with a scale per output channel.
+		result->scales.kernels[i].resize(out_channels);
+		for (size_t oc = 0; oc < out_channels; oc++) {
+			const float* channel = kernel + oc * channel_size;
+			float max_value = 0.0f;
+			for (size_t j = 0; j < channel_size; j++)
+				max_value = std::max(max_value, std::abs(channel[j]));
+
+			const float ker_scale = max_value > 0.0f ? INT8_MAX_VALUE / max_value : 1.0f;
+			result->scales.kernels[i][oc] = ker_scale;
+
+			for (size_t j = 0; j < channel_size; j++) {
+				q_kernel[oc * channel_size + j] = static_cast<std::int8_t>(
+					std::clamp(std::lround(channel[j] * ker_scale), -127l, 127l));
+			}
+
+			// Biases are added to the accumulated products, so they have theirs scale.
+			q_bias[oc] = static_cast<std::int32_t>(std::lround(bias[oc] * src_scale * ker_scale));
+		}
+	}
+
+	return result;
+}
+
+void NetworkParams::save(const QString& path, TaskKind kind, unsigned int size_multiplier) const {
+	assert(kernels.size() == biases.size());
+
+	const size_t layers = kernels.size();
+	std::vector<dnnl::memory> tensors;
+	for (size_t i = 0; i < layers; i++) {
+		tensors.push_back(kernels[i]);
+		tensors.push_back(biases[i]);
+	}
+
+	// The offsets are in the header, so its size is measured first with zero offsets.
+	const auto write_header = [&](const std::vector<quint64>& offsets) {
+		QByteArray result;
+		QDataStream stream(&result, QIODevice::WriteOnly);
+		setup_stream(stream);
+
+		stream.writeRawData(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+		stream << CONTAINER_VERSION << quint32(0); // The checksum is written in the end.
+		stream << static_cast<quint32>(kind) << static_cast<quint32>(size_multiplier)
+			   << static_cast<quint32>(!scales.empty()) << dnnl_version_code() << static_cast<quint32>(layers);
+
+		for (size_t i = 0; i < layers; i++) {
+			if (!scales.empty()) {
+				stream << scales.src[i] << static_cast<quint32>(scales.kernels[i].size());
+				for (float scale : scales.kernels[i])
+					stream << scale;
+			}
+
+			for (size_t t = i * 2; t < i * 2 + 2; t++) {
+				const dnnl::memory::desc desc = tensors[t].get_desc();
+				const auto dims = desc.dims();
+				stream << static_cast<quint32>(desc.data_type()) << static_cast<quint32>(dims.size());
+				for (auto dim : dims)
+					stream << static_cast<qint64>(dim);
+
+				// Plain layouts are written without the description, so they don't depend on the oneDNN version.
+				if (desc == plain_desc(dims, desc.data_type())) {
+					stream << quint32(0);
+				}
+				else {
+					stream << static_cast<quint32>(sizeof(desc.data));
+					stream.writeRawData(reinterpret_cast<const char*>(&desc.data), sizeof(desc.data));
+				}
+
+				stream << offsets[t] << static_cast<quint64>(desc.get_size());
+			}
+		}
+
+		return result;
+	};
+
+	const auto align = [](quint64 offset) {
+		return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+	};
+
+	std::vector<quint64> offsets(tensors.size());
+	quint64 offset = align(write_header(offsets).size());
+	for (size_t t = 0; t < tensors.size(); t++) {
+		offsets[t] = offset;
+		offset = align(offset + tensors[t].get_desc().get_size());
+	}
+
+	// Padding is zeroed, so the checksum doesn't depend on garbage.
+	QByteArray contents = write_header(offsets);
+	const int header_size = contents.size();
+	contents.resize(offset);
+	std::fill(contents.begin() + header_size, contents.end(), '\0');
+	for (size_t t = 0; t < tensors.size(); t++)
+		std::memcpy(contents.data() + offsets[t], tensors[t].get_data_handle(), tensors[t].get_desc().get_size());
+
+	const quint32 checksum = crc32(contents.constData() + CONTAINER_CHECKSUM_START,
+								   contents.size() - CONTAINER_CHECKSUM_START);
+	for (int i = 0; i < 4; i++)
+		contents[CONTAINER_CHECKSUM_START - 4 + i] = static_cast<char>((checksum >> (i * 8)) & 0xFFu);
+
+	QFile file(path);
+	if (!file.open(QFile::WriteOnly) || file.write(contents) != contents.size())
+		throw std::runtime_error("Can't write \"" + path.toStdString() + "\".");
+}
+
+std::shared_ptr<NetworkParams> NetworkParams::reordered(const std::vector<dnnl::memory::desc>& ker_descs,
+														const dnnl::engine& eng) const {
+	assert(ker_descs.size() == kernels.size());
+
+	auto result = std::make_shared<NetworkParams>();
+	result->kernels.resize(kernels.size());
+	result->biases.resize(biases.size());
+	result->scales = scales;
+
+	dnnl::stream eng_str(eng);
+	for (int i = 0; i < kernels.size(); i++) {
+		result->kernels[i] = dnnl::memory(ker_descs[i], eng);
+		dnnl::reorder(kernels[i], result->kernels[i]).execute(eng_str, kernels[i], result->kernels[i]);
+
+		// Biases keep the layout, but must not point into the data of this object.
+		result->biases[i] = dnnl::memory(biases[i].get_desc(), eng);
+		dnnl::reorder(biases[i], result->biases[i]).execute(eng_str, biases[i], result->biases[i]);
+	}
+	eng_str.wait();
+
+	return result;
+}
+
+bool NetworkParams::has_kernel_descs(const std::vector<dnnl::memory::desc>& ker_descs) const {
+	if (ker_descs.size() != kernels.size())
+		return false;
+
+	for (int i = 0; i < kernels.size(); i++) {
+		if (kernels[i].get_desc() != ker_descs[i])
+			return false;
+	}
+
+	return true;
+}
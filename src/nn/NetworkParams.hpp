@@ -0,0 +1,128 @@
+/*
+ * ImageUpscalerQt - neural network parameters header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+#include <dnnl.hpp>
+
+#include "ModelStore.hpp"
+#include "../tasks/TaskDesc.hpp"
+
+/// The same memory description, but with the layout chosen by the primitive and the given data type.
+inline dnnl::memory::desc any_format(const dnnl::memory::desc& desc, dnnl::memory::data_type data_type) {
+	return dnnl::memory::desc(desc.dims(), data_type, dnnl::memory::format_tag::any);
+}
+
+/// The same memory description of a plain layout (nchw, oihw, x), but with another data type.
+inline dnnl::memory::desc with_data_type(dnnl::memory::desc desc, dnnl::memory::data_type data_type) {
+	desc.data.data_type = dnnl::memory::convert_to_c(data_type);
+	return desc;
+}
+
+/// Data type of the biases for the data type of the computations.
+/// Biases of the int8 networks are added to the s32 accumulators, so they are quantized to s32.
+inline dnnl::memory::data_type bias_data_type(dnnl::memory::data_type data_type) {
+	return data_type == dnnl::memory::data_type::s8 ? dnnl::memory::data_type::s32 : dnnl::memory::data_type::f32;
+}
+
+/// The same window of several f32 planes that lie at a fixed distance from each other, like the channels
+/// of a PlanarImage. The networks read and write such windows right in the image, without staging copies.
+struct PlaneView {
+	/// The first pixel of the window in the first plane.
+	float* data = nullptr;
+	/// Distance between the planes and between the rows in floats.
+	dnnl::memory::dim plane_stride = 0;
+	dnnl::memory::dim row_stride = 0;
+
+	/// Description of the window as a minibatch of single-channel images (nchw with the strides).
+	dnnl::memory::desc desc(dnnl::memory::dim planes, dnnl::memory::dim height, dnnl::memory::dim width) const {
+		return dnnl::memory::desc({planes, 1, height, width}, dnnl::memory::data_type::f32,
+								  dnnl::memory::dims{plane_stride, plane_stride, row_stride, 1});
+	}
+};
+
+/// Maximal absolute value of the f32 memory (in any layout).
+float max_abs_value(const dnnl::memory& mem);
+
+/// Scales of an int8 network. A value is quantized as round(value * scale).
+struct QuantizationScales {
+	/// Scale of the source of every layer.
+	std::vector<float> src;
+	/// Scales of the kernels of every layer, one per output channel.
+	std::vector<std::vector<float>> kernels;
+
+	bool empty() const {
+		return src.empty();
+	}
+
+	/// Output scales of the layer for the primitive. They convert the accumulated products
+	/// into the source scale of the next layer, the last layer outputs unscaled f32.
+	std::vector<float> output_scales(size_t layer) const;
+};
+
+/// Kernels and biases of every layer of a neural network.
+/// Networks with the same architecture share one instance.
+struct NetworkParams {
+	/// Model file of the loaded parameters, the memories point right into it (it is read-only,
+	/// but oneDNN never writes to the kernels and the biases). nullptr for the other parameters.
+	std::shared_ptr<const ModelFile> file;
+	/// Raw quantized parameters or the aligned copy of a misaligned model file, the memories point into it.
+	/// Empty if the memories don't point into it.
+	QByteArray data;
+	std::vector<dnnl::memory> kernels;
+	std::vector<dnnl::memory> biases;
+	/// Scales of the quantized (s8 kernels, s32 biases) parameters, empty for f32.
+	QuantizationScales scales;
+
+	/// Load the parameters from the model file (see ModelStore). Nothing is copied.
+	/// Model containers (see save()) are recognized by the header: the shapes of the
+	/// kernels and biases are checked against the descriptions, the checksum is verified, and
+	/// the kernels may be s8 (with s32 biases) and in the blocked layouts of the primitives.
+	/// Other files are raw f32 kernels and biases of every layer one after another.
+	/// Quantized models are only in the containers.
+	/// @param kind, size_multiplier The network the model container must be of.
+	/// @param quantized Whether the model must be quantized (for int8) or f32.
+	/// @throws std::runtime_error if the file can't be read, is damaged, is of another network or precision,
+	/// or doesn't match the descriptions.
+	static std::shared_ptr<NetworkParams> load(const QString& path, TaskKind kind, unsigned int size_multiplier,
+											   bool quantized,
+											   const std::vector<dnnl::memory::desc>& ker_descs,
+											   const std::vector<dnnl::memory::desc>& bias_descs,
+											   const dnnl::engine& eng);
+
+	/// Read only the scales of the quantized model container, the networks need them to be built.
+	/// @throws std::runtime_error if the file can't be read or it is not a quantized model container.
+	static QuantizationScales load_scales(const QString& path);
+
+	/// Quantize the planar f32 parameters to int8.
+	/// @param src_max Maximal absolute value of the source of every layer, measured on sample images.
+	static std::shared_ptr<NetworkParams> quantize(const NetworkParams& params, const std::vector<float>& src_max,
+												   const dnnl::engine& eng);
+
+	/// Write the parameters to the model container (little endian):
+	/// - "IUMC", version, CRC-32 of everything after it;
+	/// - task kind (srcnn or fsrcnn), size multiplier, whether quantized, oneDNN version, amount of layers;
+	/// - for every layer: source scale and kernel scales (quantized only), then the kernels and
+	///   the biases as data type, dimensions, oneDNN memory description (blocked layouts only),
+	///   offset and size in the file;
+	/// - the parameters, every tensor aligned to 64 bytes, so they are used right from the mapped file.
+	/// Blocked layouts are loaded only by the same oneDNN version.
+	/// @throws std::runtime_error if the file can't be written.
+	void save(const QString& path, TaskKind kind, unsigned int size_multiplier) const;
+
+	/// Copy of the parameters with the kernels reordered into the given layouts
+	/// (usually the blocked ones chosen by the primitives).
+	std::shared_ptr<NetworkParams> reordered(const std::vector<dnnl::memory::desc>& ker_descs,
+											 const dnnl::engine& eng) const;
+
+	/// Whether the kernels are in the given layouts.
+	bool has_kernel_descs(const std::vector<dnnl::memory::desc>& ker_descs) const;
+};
@@ -4,27 +4,34 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
-#include <iostream>
+#include <algorithm>
+#include <cassert>
 
 #include "SRCNN.hpp"
 
-SRCNN::SRCNN(const unsigned short img_w, const unsigned short img_h, const SRCNNDesc& desc) {
-	init_src_descs(desc.channels, img_w, img_h);
+SRCNN::SRCNN(const unsigned short img_w, const unsigned short img_h, const int batch,
+			 const SRCNNDesc& desc, const dnnl::engine& eng, dnnl::memory::data_type data_type,
+			 const QuantizationScales& scales) :
+			 eng(eng), data_type(data_type), scales(scales) {
+	assert(data_type != dnnl::memory::data_type::s8 || this->scales.src.size() == 3);
+
+	init_src_descs(desc.channels, img_w, img_h, batch);
 	init_ker_descs(desc.channels, desc.kernels);
 	init_bias_descs(desc.channels);
-	init_dest_descs(desc.channels, img_w, img_h);
+	init_dest_descs(desc.channels, img_w, img_h, batch);
 	init_pads(desc.kernels);
 
-	eng = dnnl::engine(dnnl::engine::kind::cpu, 0);
 	eng_str = dnnl::stream(eng);
 
 	init_conv();
+	init_reorders();
+	init_buffers();
 }
 
 void inline SRCNN::init_src_descs(const std::array<unsigned short, 4>& chn,
-								  const unsigned short img_w, const unsigned short img_h) {
+								  const unsigned short img_w, const unsigned short img_h, const int batch) {
 	for (int i = 0; i < 3; i++) {
-		dnnl::memory::dims cur_dims = {1, chn[i], img_h, img_w};
+		dnnl::memory::dims cur_dims = {batch, chn[i], img_h, img_w};
 		src_descs[i] = dnnl::memory::desc(cur_dims, dnnl::memory::data_type::f32,
 										  dnnl::memory::format_tag::nchw);
 	}
@@ -48,9 +55,9 @@ void inline SRCNN::init_bias_descs(const std::array<unsigned short, 4>& chn) {
 }
 
 void inline SRCNN::init_dest_descs(const std::array<unsigned short, 4>& chn,
-								   const unsigned short img_w, const unsigned short img_h) {
+								   const unsigned short img_w, const unsigned short img_h, const int batch) {
 	for (int i = 0; i < 3; i++) {
-		dnnl::memory::dims cur_dims = {1, chn[i + 1], img_h, img_w};
+		dnnl::memory::dims cur_dims = {batch, chn[i + 1], img_h, img_w};
 		dest_descs[i] = dnnl::memory::desc(cur_dims, dnnl::memory::data_type::f32,
 										   dnnl::memory::format_tag::nchw);
 	}
@@ -64,44 +71,165 @@ void inline SRCNN::init_pads(const std::array<unsigned short, 3>& ker) {
 }
 
 void inline SRCNN::init_conv() {
+	const bool quantized = data_type == dnnl::memory::data_type::s8;
+
 	dnnl::post_ops post_ops;
 	post_ops.append_eltwise(1.0f, dnnl::algorithm::eltwise_relu, 0.15f, 0.0f);
-	dnnl::primitive_attr attr;
-	attr.set_post_ops(post_ops);
 	for (int i = 0; i < 3; i++) {
+		dnnl::primitive_attr attr;
+		attr.set_post_ops(post_ops);
+		// Scale the s32 accumulators of every output channel into the s8 source of the next layer.
+		if (quantized)
+			attr.set_output_scales(1 << 1, scales.output_scales(i));
+
+		// Let the primitives choose the layouts. The source of every next layer
+		// is the destination of the previous one, so the activations are not reordered between the layers.
+		const dnnl::memory::desc cur_src_desc = i == 0 ? any_format(src_descs[i], data_type) : prim_dest_descs[i - 1];
+		// The last layer of the int8 network outputs f32.
+		const auto dest_data_type = quantized && i == 3 - 1 ? dnnl::memory::data_type::f32 : data_type;
+
 		auto conv_desc = dnnl::convolution_forward::desc(dnnl::prop_kind::forward_inference,
 						 dnnl::algorithm::convolution_auto,
-						 src_descs[i], ker_descs[i], bias_descs[i],
-						 dest_descs[i], {1, 1}, pads_l[i], pads_r[i]);
+						 cur_src_desc, any_format(ker_descs[i], data_type),
+						 with_data_type(bias_descs[i], bias_data_type(data_type)),
+						 any_format(dest_descs[i], dest_data_type), {1, 1}, pads_l[i], pads_r[i]);
 
 		auto conv_prim_desc = dnnl::convolution_forward::primitive_desc(conv_desc, attr, eng);
 
+		if (i == 0)
+			prim_src_desc = conv_prim_desc.src_desc();
+		prim_ker_descs[i] = conv_prim_desc.weights_desc();
+		prim_dest_descs[i] = conv_prim_desc.dst_desc();
+
 		convs[i] = dnnl::convolution_forward(conv_prim_desc);
 	}
 }
 
-void SRCNN::execute(dnnl::memory src_mem, std::array<dnnl::memory, 3> ker_mem,
-					std::array<dnnl::memory, 3> bias_mem, dnnl::memory dest_mem) {
-	dnnl::memory cur_dest;
+void inline SRCNN::init_reorders() {
+	reorder_input = prim_src_desc != src_descs[0];
+	if (reorder_input) {
+		// Quantize the input of the int8 network.
+		dnnl::primitive_attr attr;
+		if (data_type == dnnl::memory::data_type::s8)
+			attr.set_output_scales(0, {scales.src[0]});
+		input_reorder = dnnl::reorder(dnnl::reorder::primitive_desc(eng, src_descs[0], eng, prim_src_desc, attr));
+	}
 
-	for (char i = 0; i < 3; i++) {
-		dnnl::memory cur_src;
+	reorder_output = prim_dest_descs[2] != dest_descs[2];
+	if (reorder_output)
+		output_reorder = dnnl::reorder(dnnl::reorder::primitive_desc(eng, prim_dest_descs[2], eng, dest_descs[2]));
+}
 
-		if (i == 0)
-			cur_src = src_mem;
-		else
-			cur_src = cur_dest;
+void inline SRCNN::init_buffers() {
+	// The last layer writes straight into the output if it doesn't have to be reordered.
+	const int buffered_layers = reorder_output ? 3 : 3 - 1;
+
+	// Both activation buffers are big enough for the largest layer.
+	dnnl::memory::desc largest_desc = prim_dest_descs[0];
+	for (int i = 1; i < buffered_layers; i++) {
+		if (prim_dest_descs[i].get_size() > largest_desc.get_size())
+			largest_desc = prim_dest_descs[i];
+	}
+	for (auto& buffer : activation_buffers)
+		buffer = dnnl::memory(largest_desc, eng);
+
+	for (int i = 0; i < buffered_layers; i++)
+		dest_mems[i] = dnnl::memory(prim_dest_descs[i], eng, activation_buffers[i % 2].get_data_handle());
+
+	if (reorder_input)
+		prim_src_mem = dnnl::memory(prim_src_desc, eng);
+
+	input_mem = dnnl::memory(src_descs[0], eng);
+	output_mem = dnnl::memory(dest_descs[2], eng);
+}
+
+void SRCNN::execute(dnnl::memory src_mem, dnnl::memory dest_mem, std::vector<float>* src_max) {
+	// Reorder the planar input into the layout of the first layer.
+	dnnl::memory cur_src = src_mem;
+	if (reorder_input) {
+		input_reorder.execute(eng_str, src_mem, prim_src_mem);
+		cur_src = prim_src_mem;
+	}
 
-		if (i == 3 - 1)
-			cur_dest = dest_mem;
-		else
-			cur_dest = dnnl::memory(dest_descs[i], eng);
+	execute_layers(cur_src, reorder_output ? dest_mems[2] : dest_mem, src_max);
+
+	// Reorder the output back to planar.
+	if (reorder_output)
+		output_reorder.execute(eng_str, dest_mems[2], dest_mem);
+
+	eng_str.wait();
+}
+
+void SRCNN::execute(const PlaneView& src, const PlaneView& dest, dnnl::memory::dim dest_height,
+					dnnl::memory::dim dest_width, dnnl::memory::dim dest_y, dnnl::memory::dim dest_x) {
+	const dnnl::memory::dims& in_dims = src_descs[0].dims();
+	const dnnl::memory::dims& out_dims = dest_descs[2].dims();
+	const dnnl::memory::dim batch = in_dims[0];
+
+	// The first layer reads the planes right away if they are in its layout.
+	const dnnl::memory view_src(src.desc(batch, in_dims[2], in_dims[3]), eng, src.data);
+	dnnl::memory layers_src = view_src;
+	if (reorder_input || view_src.get_desc() != src_descs[0]) {
+		layers_src = reorder_input ? prim_src_mem : input_mem;
+		auto reorder = view_input_reorders.find({src.plane_stride, src.row_stride});
+		if (reorder == view_input_reorders.end()) {
+			// Quantize the input of the int8 network.
+			dnnl::primitive_attr attr;
+			if (data_type == dnnl::memory::data_type::s8)
+				attr.set_output_scales(0, {scales.src[0]});
+			reorder = view_input_reorders.emplace(std::array{src.plane_stride, src.row_stride},
+				dnnl::reorder::primitive_desc(eng, view_src.get_desc(), eng, layers_src.get_desc(), attr)).first;
+		}
+		reorder->second.execute(eng_str, view_src, layers_src);
+	}
+
+	// The last layer writes right into the planes if the part is the whole output in its layout.
+	const dnnl::memory view_dest(dest.desc(batch, dest_height, dest_width), eng, dest.data);
+	if (!reorder_output && dest_y == 0 && dest_x == 0 && dest_height == out_dims[2] && dest_width == out_dims[3] &&
+		view_dest.get_desc() == dest_descs[2]) {
+		execute_layers(layers_src, view_dest, nullptr);
+		eng_str.wait();
+		return;
+	}
+
+	const dnnl::memory layers_dest = reorder_output ? dest_mems[2] : output_mem;
+	execute_layers(layers_src, layers_dest, nullptr);
+
+	const std::array<dnnl::memory::dim, 6> key = {dest.plane_stride, dest.row_stride, dest_height, dest_width,
+												   dest_y, dest_x};
+	const dnnl::memory part(layers_dest.get_desc().submemory_desc({batch, 1, dest_height, dest_width},
+																  {0, 0, dest_y, dest_x}),
+							eng, layers_dest.get_data_handle());
+	auto reorder = view_output_reorders.find(key);
+	if (reorder == view_output_reorders.end())
+		reorder = view_output_reorders.emplace(key, dnnl::reorder(part, view_dest)).first;
+	reorder->second.execute(eng_str, part, view_dest);
+
+	eng_str.wait();
+}
+
+void SRCNN::execute_layers(dnnl::memory src_mem, dnnl::memory dest_mem, std::vector<float>* src_max) {
+	assert(params != nullptr && params->kernels.size() == 3);
+	assert(src_max == nullptr || data_type == dnnl::memory::data_type::f32);
+	if (src_max != nullptr && src_max->size() < 3)
+		src_max->resize(3, 0.0f);
+
+	dnnl::memory cur_src = src_mem;
+	for (char i = 0; i < 3; i++) {
+		dnnl::memory cur_dest = i == 3 - 1 ? dest_mem : dest_mems[i];
+
+		if (src_max != nullptr) {
+			eng_str.wait();
+			(*src_max)[i] = std::max((*src_max)[i], max_abs_value(cur_src));
+		}
 
 		convs[i].execute(eng_str, {
 			{DNNL_ARG_SRC, cur_src},
-			{DNNL_ARG_WEIGHTS, ker_mem[i]},
-			{DNNL_ARG_BIAS, bias_mem[i]},
+			{DNNL_ARG_WEIGHTS, params->kernels[i]},
+			{DNNL_ARG_BIAS, params->biases[i]},
 			{DNNL_ARG_DST, cur_dest}
 		});
+
+		cur_src = cur_dest;
 	};
 }
@@ -7,39 +7,85 @@
 #pragma once
 
 #include <array>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include <dnnl.hpp>
 
+#include "NetworkParams.hpp"
 #include "../tasks/TaskDesc.hpp"
 
 class SRCNN {
 private:
 	dnnl::engine eng;
 	dnnl::stream eng_str;
+	/// Data type of the activations and the kernels. Planar input and output are always f32.
+	dnnl::memory::data_type data_type;
+	/// Scales of the int8 (s8) network, empty otherwise.
+	QuantizationScales scales;
 
 	std::array<dnnl::memory::desc, 3> src_descs; // Source memory description.
 	std::array<dnnl::memory::desc, 3> ker_descs; // Kernels (weights) memory description.
 	std::array<dnnl::memory::desc, 3> bias_descs; // Biases memory description.
 	std::array<dnnl::memory::desc, 3> dest_descs; // Destination memory description.
 
+	// Layouts chosen by the primitives (usually blocked, like nChw16c and OIhw16i16o).
+	dnnl::memory::desc prim_src_desc;
+	std::array<dnnl::memory::desc, 3> prim_ker_descs;
+	std::array<dnnl::memory::desc, 3> prim_dest_descs;
+
+	// Reorders of the planar input and output, if the primitives want other layouts.
+	bool reorder_input = false;
+	bool reorder_output = false;
+	dnnl::reorder input_reorder;
+	dnnl::reorder output_reorder;
+	// Reorders of the windows of the planes (see PlaneView), created on the first use of every layout.
+	// The windows of an image share the strides, only the parts at the edges of the output differ.
+	std::map<std::array<dnnl::memory::dim, 2>, dnnl::reorder> view_input_reorders; // By {plane, row} stride.
+	// By the strides, the size and the position of the part of the output.
+	std::map<std::array<dnnl::memory::dim, 6>, dnnl::reorder> view_output_reorders;
+
+	// Buffers allocated once and reused by every execute().
+	// Layers write into two activation buffers in turn (ping-pong).
+	std::array<dnnl::memory, 2> activation_buffers;
+	std::array<dnnl::memory, 3> dest_mems; // Destination memory of every layer in the activation buffers.
+	dnnl::memory prim_src_mem; // Input in the layout of the first layer.
+	dnnl::memory input_mem; // Planar input.
+	dnnl::memory output_mem; // Planar output.
+
 	std::array<dnnl::memory::dims, 3> pads_l;
 	std::array<dnnl::memory::dims, 3> pads_r;
 
 	// Convolution layer primitives descriptions.
 	std::array<dnnl::convolution_forward, 3> convs;
 
+	std::shared_ptr<const NetworkParams> params;
+
 	void init_src_descs(const std::array<unsigned short, 4>& chn,
-						const unsigned short img_w, const unsigned short img_h);
+						const unsigned short img_w, const unsigned short img_h, const int batch);
 	void init_ker_descs(const std::array<unsigned short, 4>& chn,
 						const std::array<unsigned short, 3>& ker);
 	void init_bias_descs(const std::array<unsigned short, 4>& chn);
 	void init_dest_descs(const std::array<unsigned short, 4>& chn,
-						 const unsigned short img_w, const unsigned short img_h);
+						 const unsigned short img_w, const unsigned short img_h, const int batch);
 	void init_pads(const std::array<unsigned short, 3>& ker);
 	void init_conv();
+	void init_reorders();
+	void init_buffers();
+	/// Run the layers from the source in the layout of the first layer
+	/// to the destination in the layout of the last one.
+	void execute_layers(dnnl::memory src_mem, dnnl::memory dest_mem, std::vector<float>* src_max);
 
 public:
-	SRCNN(const unsigned short img_w, const unsigned short img_h, const SRCNNDesc& desc);
+	/// The engine is usually shared by all networks (see NetworkCache).
+	/// @param batch Amount of single-channel images processed by one execute().
+	/// @param data_type Data type of the computations, f32, bf16 or s8.
+	/// @param scales Scales of the quantized parameters, required for s8.
+	SRCNN(const unsigned short img_w, const unsigned short img_h, const int batch,
+		  const SRCNNDesc& desc, const dnnl::engine& eng,
+		  dnnl::memory::data_type data_type = dnnl::memory::data_type::f32,
+		  const QuantizationScales& scales = {});
 
 	std::array<dnnl::memory::desc, 3> get_ker_descs() const {
 		return ker_descs;
@@ -49,6 +95,11 @@ public:
 		return bias_descs;
 	}
 
+	/// Kernel layouts the primitives expect. The parameters must be reordered into them.
+	std::array<dnnl::memory::desc, 3> get_prim_ker_descs() const {
+		return prim_ker_descs;
+	}
+
 	dnnl::memory::desc get_input_desc() const {
 		return src_descs[0];
 	}
@@ -61,6 +112,46 @@ public:
 		return eng;
 	}
 
-	void execute(dnnl::memory src_mem, std::array<dnnl::memory, 3> ker_mem,
-				 std::array<dnnl::memory, 3> bias_mem, dnnl::memory dest_mem);
+	/// Parameters must be set before execute().
+	void set_params(std::shared_ptr<const NetworkParams> params) {
+		this->params = params;
+	}
+
+	/// @param src_max If not null, receives the maximal absolute value of the source of every layer
+	/// (if it is greater than the current one). Only for f32, used to calibrate the int8 quantization.
+	void execute(dnnl::memory src_mem, dnnl::memory dest_mem, std::vector<float>* src_max = nullptr);
+	/// Execute with the own input and output memory.
+	void execute() {
+		execute(input_mem, output_mem);
+	}
+	/// Execute on the windows of the planes without staging copies. The first layer reads the planes right away
+	/// if they are in its layout, otherwise they are reordered into it. The last layer writes right into
+	/// the destination planes if the part is its whole output in its layout, otherwise the part is reordered
+	/// into them. The reorders are created once for every layout of the windows.
+	/// The minibatch is the planes of the window.
+	/// @param src Input window of the size of the network.
+	/// @param dest Destination of the part of the output.
+	/// @param dest_height, dest_width Size of the part of the output (of the upscaled window).
+	/// @param dest_y, dest_x Position of the part in the output.
+	void execute(const PlaneView& src, const PlaneView& dest, dnnl::memory::dim dest_height,
+				 dnnl::memory::dim dest_width, dnnl::memory::dim dest_y, dnnl::memory::dim dest_x);
+
+	/// Size of the buffers allocated by the network in bytes.
+	size_t get_buffers_size() const {
+		size_t result = activation_buffers[0].get_desc().get_size() * 2 +
+			input_mem.get_desc().get_size() + output_mem.get_desc().get_size();
+		if (reorder_input)
+			result += prim_src_mem.get_desc().get_size();
+		return result;
+	}
+
+	/// Planar input memory of the network, allocated once. Write the input here before execute().
+	dnnl::memory get_input_memory() const {
+		return input_mem;
+	}
+
+	/// Planar output memory of the network, allocated once. Read the output here after execute().
+	dnnl::memory get_output_memory() const {
+		return output_mem;
+	}
 };
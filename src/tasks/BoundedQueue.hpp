@@ -0,0 +1,66 @@
+/*
+ * ImageUpscalerQt - bounded blocking queue header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/// Thread-safe FIFO queue with limited capacity.
+/// Used to connect the stages of the Worker pipeline, so the capacity caps the amount
+/// of images that are kept in memory between two stages.
+template<typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+	/// Block while the queue is full.
+	/// @returns false if the queue is closed. The item is dropped in this case.
+	bool push(T&& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	/// Block while the queue is empty.
+	/// @returns false if the queue is closed and there are no items left.
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+		if (items.empty())
+			return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	/// Wake up every waiting thread and reject new items.
+	/// Items that are already in the queue can still be popped.
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+private:
+	const size_t capacity;
+	std::deque<T> items;
+	bool closed = false;
+
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+};
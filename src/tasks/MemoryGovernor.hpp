@@ -0,0 +1,67 @@
+/*
+ * ImageUpscalerQt - memory governor header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+/// Memory budget shared by the images in flight. An image is admitted only when its peak
+/// memory demand fits in what the other images left, so the budget is never exceeded.
+/// An image that doesn't fit even alone is admitted when nothing else is in flight.
+class MemoryGovernor {
+public:
+	/// Start over with the budget in bytes. Nothing is reserved after it.
+	void reset(unsigned long long budget) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->budget = budget;
+		used = 0;
+		closed = false;
+	}
+
+	/// Block until the bytes fit in the budget and reserve them.
+	/// @returns false if the governor is closed. Nothing is reserved in this case.
+	bool acquire(unsigned long long bytes) {
+		std::unique_lock<std::mutex> lock(mutex);
+		released.wait(lock, [this, bytes]() { return closed || used == 0 || used + bytes <= budget; });
+		if (closed)
+			return false;
+
+		used += bytes;
+		return true;
+	}
+
+	void release(unsigned long long bytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		used -= std::min(used, bytes);
+		released.notify_all();
+	}
+
+	/// Wake up and refuse all acquire() calls, used to stop the pipeline.
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		released.notify_all();
+	}
+
+	unsigned long long get_budget() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return budget;
+	}
+
+	unsigned long long get_used() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return used;
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::condition_variable released;
+	unsigned long long budget = 0;
+	unsigned long long used = 0;
+	bool closed = false;
+};
@@ -0,0 +1,121 @@
+/*
+ * ImageUpscalerQt - planar image
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "PlanarImage.hpp"
+
+/// Rows converted from and to the interleaved buffers at a time.
+constexpr int CONVERSION_ROWS = 64;
+
+void PlanarImage::AlignedDeleter::operator()(float* ptr) const {
+	::operator delete[](ptr, std::align_val_t(ALIGNMENT));
+}
+
+PlanarImage::PlanarImage(int width, int height, int channels) : w(width), h(height), ch(channels) {
+	constexpr size_t row_alignment = ALIGNMENT / sizeof(float);
+	stride = (static_cast<size_t>(width) + row_alignment - 1) / row_alignment * row_alignment;
+	data.reset(static_cast<float*>(::operator new[](plane_size() * channels * sizeof(float),
+													std::align_val_t(ALIGNMENT))));
+
+	// The padding is processed along with the rows by the whole plane operations, so it must hold numbers.
+	if (stride != static_cast<size_t>(width)) {
+		for (int c = 0; c < channels; c++) {
+			for (int y = 0; y < height; y++)
+				std::fill(row(c, y) + width, row(c, y) + stride, 0.0f);
+		}
+	}
+}
+
+PlanarImage PlanarImage::clone() const {
+	PlanarImage result(w, h, ch);
+	std::memcpy(result.data.get(), data.get(), plane_size() * ch * sizeof(float));
+	return result;
+}
+
+PlanarImage PlanarImage::from_image_buf(const OIIO::ImageBuf& buf) {
+	const OIIO::ROI roi = buf.roi();
+	PlanarImage result(roi.width(), roi.height(), roi.nchannels());
+
+	// The buffer converts its format to float, the rows are split into planes here.
+	std::vector<float> rows(static_cast<size_t>(result.w) * result.ch * CONVERSION_ROWS);
+	for (int y = 0; y < result.h; y += CONVERSION_ROWS) {
+		const int count = std::min(CONVERSION_ROWS, result.h - y);
+		OIIO::ROI rows_roi = roi;
+		rows_roi.ybegin = roi.ybegin + y;
+		rows_roi.yend = roi.ybegin + y + count;
+		if (!buf.get_pixels(rows_roi, OIIO::TypeDesc::FLOAT, rows.data()))
+			throw std::runtime_error("Can't read the pixels of the image.\nMessage:\n" + buf.geterror());
+
+		for (int r = 0; r < count; r++) {
+			for (int c = 0; c < result.ch; c++) {
+				const float* src = rows.data() + static_cast<size_t>(r) * result.w * result.ch + c;
+				float* dest = result.row(c, y + r);
+				for (int x = 0; x < result.w; x++)
+					dest[x] = src[static_cast<size_t>(x) * result.ch];
+			}
+		}
+	}
+
+	return result;
+}
+
+PlanarImage PlanarImage::from_interleaved(const float* pixels, int width, int height, int channels) {
+	PlanarImage result(width, height, channels);
+	for (int y = 0; y < height; y++) {
+		const float* src_row = pixels + static_cast<size_t>(y) * width * channels;
+		for (int c = 0; c < channels; c++) {
+			float* dest = result.row(c, y);
+			for (int x = 0; x < width; x++)
+				dest[x] = src_row[static_cast<size_t>(x) * channels + c];
+		}
+	}
+
+	return result;
+}
+
+void PlanarImage::to_interleaved(int ybegin, int yend, float* pixels) const {
+	for (int y = ybegin; y < yend; y++) {
+		float* dest_row = pixels + static_cast<size_t>(y - ybegin) * w * ch;
+		for (int c = 0; c < ch; c++) {
+			const float* src = row(c, y);
+			for (int x = 0; x < w; x++)
+				dest_row[static_cast<size_t>(x) * ch + c] = src[x];
+		}
+	}
+}
+
+OIIO::ImageBuf PlanarImage::to_image_buf() const {
+	OIIO::ImageBuf result(OIIO::ImageSpec(w, h, ch, OIIO::TypeDesc::FLOAT));
+	to_interleaved(0, h, static_cast<float*>(result.localpixels()));
+	return result;
+}
+
+OIIO::ImageBuf PlanarImage::to_image_buf(const OIIO::ImageSpec& metadata) const {
+	OIIO::ImageBuf result = to_image_buf();
+	OIIO::ImageSpec& spec = result.specmod();
+	spec.extra_attribs = metadata.extra_attribs;
+	if (metadata.nchannels == ch) {
+		spec.channelnames = metadata.channelnames;
+		spec.alpha_channel = metadata.alpha_channel;
+		spec.z_channel = metadata.z_channel;
+	}
+	return result;
+}
+
+OIIO::ImageBuf PlanarImage::plane_buf(int channel) {
+	return OIIO::ImageBuf(OIIO::ImageSpec(w, h, 1, OIIO::TypeDesc::FLOAT), plane(channel),
+						  sizeof(float), stride * sizeof(float));
+}
+
+OIIO::ImageBuf PlanarImage::plane_buf(int channel) const {
+	// Wrapped buffers are always writable for OpenImageIO, the const version is only read by the callers.
+	return const_cast<PlanarImage*>(this)->plane_buf(channel);
+}
@@ -0,0 +1,105 @@
+/*
+ * ImageUpscalerQt - planar image header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <OpenImageIO/imagebuf.h>
+
+/// Float image stored plane by plane (channel-major). Every row starts at a 64-byte boundary,
+/// so rows go to and from the neural networks with plain copies and are processed with whole vectors.
+/// The tasks take and produce these images, the interleaved OIIO::ImageBuf is used only to read
+/// and write the files. Move-only: the images are handed over between the tasks, never copied implicitly.
+class PlanarImage {
+public:
+	/// Alignment of the rows in bytes.
+	static constexpr size_t ALIGNMENT = 64;
+
+	PlanarImage() = default;
+	/// Image with uninitialized pixels. The padding of the rows is zeroed.
+	PlanarImage(int width, int height, int channels);
+
+	PlanarImage(PlanarImage&&) noexcept = default;
+	PlanarImage& operator=(PlanarImage&&) noexcept = default;
+	PlanarImage(const PlanarImage&) = delete;
+	PlanarImage& operator=(const PlanarImage&) = delete;
+
+	/// Deep copy.
+	PlanarImage clone() const;
+
+	/// Pixels of the buffer in any format.
+	/// @throws std::runtime_error if the pixels can't be read.
+	static PlanarImage from_image_buf(const OIIO::ImageBuf& buf);
+	/// Interleaved float pixels, like the ones of a strip.
+	static PlanarImage from_interleaved(const float* pixels, int width, int height, int channels);
+	/// Interleaved float buffer with the pixels.
+	OIIO::ImageBuf to_image_buf() const;
+	/// The same, with the metadata (attributes, channel names, alpha channel) of the spec.
+	/// The size and the format of the spec are ignored. The channel names are kept only if the amount matches.
+	OIIO::ImageBuf to_image_buf(const OIIO::ImageSpec& metadata) const;
+	/// Write the rows [ybegin, yend) as interleaved float pixels.
+	void to_interleaved(int ybegin, int yend, float* pixels) const;
+
+	/// Single-channel buffer that wraps the plane without copying, for the OpenImageIO algorithms.
+	OIIO::ImageBuf plane_buf(int channel);
+	/// The same, but the buffer must not be written.
+	OIIO::ImageBuf plane_buf(int channel) const;
+
+	int width() const {
+		return w;
+	}
+
+	int height() const {
+		return h;
+	}
+
+	int channels() const {
+		return ch;
+	}
+
+	bool empty() const {
+		return data == nullptr;
+	}
+
+	/// Distance between the rows in floats.
+	size_t row_stride() const {
+		return stride;
+	}
+
+	/// Floats in a plane, including the padding of the rows.
+	size_t plane_size() const {
+		return stride * h;
+	}
+
+	float* plane(int channel) {
+		return data.get() + plane_size() * channel;
+	}
+
+	const float* plane(int channel) const {
+		return data.get() + plane_size() * channel;
+	}
+
+	float* row(int channel, int y) {
+		return plane(channel) + stride * y;
+	}
+
+	const float* row(int channel, int y) const {
+		return plane(channel) + stride * y;
+	}
+
+private:
+	struct AlignedDeleter {
+		void operator()(float* ptr) const;
+	};
+
+	std::unique_ptr<float[], AlignedDeleter> data;
+	int w = 0;
+	int h = 0;
+	int ch = 0;
+	size_t stride = 0;
+};
@@ -6,18 +6,36 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
 
-#include <OpenImageIO/imagebuf.h>
 #include <QString>
 
 #include "TaskDesc.hpp"
+#include "PlanarImage.hpp"
 
 class Task {
 public:
-	bool cancel_requested = false;
+	/// Set by the GUI or the Worker while do_task() runs in another thread.
+	std::atomic<bool> cancel_requested = false;
+	/// Memory that one execution of the neural networks may take, in bytes. 0 means no limit.
+	/// Set by the Worker before every image to keep within its memory budget.
+	unsigned long long network_memory_limit = 0;
+	/// Time the last do_task() spent taking the neural networks from the cache (building them
+	/// on a miss) and executing them, in milliseconds. Zero in the tasks without neural networks.
+	double network_construction_ms = 0.0;
+	double network_execution_ms = 0.0;
 
+	virtual ~Task() = default;
 	virtual float progress() const { return 0; };
-	virtual OIIO::ImageBuf do_task(const OIIO::ImageBuf input, std::function<void()> cancelled) = 0;
+	/// Set cancel_requested. The tasks that run other tasks pass it on to them.
+	virtual void set_cancel_requested(bool requested) { cancel_requested = requested; }
+	/// Details of the current work for the user, like parameters chosen at run time. Empty if there are none.
+	virtual QString status() const { return QString(); }
+	/// Process the image. The task takes over the input: tasks that can work in place change its
+	/// pixels and return it, the others free it when they don't need it anymore.
+	/// The images stay planar through the whole chain, the Worker converts them only to read and write the files.
+	/// @returns the result, or the input if cancelled.
+	virtual PlanarImage do_task(PlanarImage&& input, std::function<void()> cancelled) = 0;
 	virtual const TaskDesc* get_desc() const = 0;
 };
@@ -0,0 +1,175 @@
+/*
+ * ImageUpscalerQt - task chain optimizer
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "TaskChainOptimizer.hpp"
+#include "../functions/func.hpp"
+
+/// The conversion of the color space task, nullptr for the other tasks.
+const ColorSpaceConversion* conversion_of(const TaskDesc& desc) {
+	if (desc.task_kind() != TaskKind::convert_color_space)
+		return nullptr;
+	return &static_cast<const TaskConvertColorSpaceDesc&>(desc).color_space_conversion;
+}
+
+/// Whether the second conversion undoes the first one.
+bool inverse_conversions(ColorSpaceConversion first, ColorSpaceConversion second) {
+	using C = ColorSpaceConversion;
+	return (first == C::rgb_to_ycbcr && second == C::ycbcr_to_rgb) ||
+		(first == C::ycbcr_to_rgb && second == C::rgb_to_ycbcr) ||
+		(first == C::rgb_to_ycocg && second == C::ycocg_to_rgb) ||
+		(first == C::ycocg_to_rgb && second == C::rgb_to_ycocg);
+}
+
+/// Whether the task is a luma-only neural network that doesn't take YCbCr input (or output) yet.
+bool can_fuse(const TaskDesc& desc, bool output) {
+	if (desc.task_kind() == TaskKind::srcnn) {
+		const auto& cnn_desc = static_cast<const TaskSRCNNDesc&>(desc);
+		return cnn_desc.luma_only && !(output ? cnn_desc.ycbcr_output : cnn_desc.ycbcr_input);
+	}
+	if (desc.task_kind() == TaskKind::fsrcnn) {
+		const auto& cnn_desc = static_cast<const TaskFSRCNNDesc&>(desc);
+		return cnn_desc.luma_only && !(output ? cnn_desc.ycbcr_output : cnn_desc.ycbcr_input);
+	}
+	return false;
+}
+
+/// Copy of the neural network task that takes YCbCr input (or keeps YCbCr output).
+template<typename Desc>
+std::shared_ptr<TaskDesc> fused_copy_as(const TaskDesc& desc, bool output) {
+	auto result = std::make_shared<Desc>(static_cast<const Desc&>(desc));
+	(output ? result->ycbcr_output : result->ycbcr_input) = true;
+	return result;
+}
+
+std::shared_ptr<TaskDesc> fused_copy(const TaskDesc& desc, bool output) {
+	return desc.task_kind() == TaskKind::srcnn ? fused_copy_as<TaskSRCNNDesc>(desc, output) :
+		fused_copy_as<TaskFSRCNNDesc>(desc, output);
+}
+
+TaskChainOptimizer::TaskChainOptimizer(QSize sample_size, int channels) :
+	sample_size(sample_size), channels(channels) {}
+
+std::vector<std::shared_ptr<TaskDesc>> TaskChainOptimizer::optimize(
+	const std::vector<std::shared_ptr<TaskDesc>>& chain) {
+	log.clear();
+	saved_operations = 0;
+	color_rewritten = false;
+
+	// Every rewrite makes other tasks adjacent, so repeat until nothing changes.
+	// The conversions are canceled before fusing, so a fused conversion never hides its inverse.
+	std::vector<std::shared_ptr<TaskDesc>> result = chain;
+	while (eliminate(result) || fuse(result)) {}
+	return result;
+}
+
+bool TaskChainOptimizer::eliminate(std::vector<std::shared_ptr<TaskDesc>>& chain) {
+	for (size_t i = 0; i + 1 < chain.size(); i++) {
+		const TaskDesc& first = *chain[i];
+		const TaskDesc& second = *chain[i + 1];
+		const QSize size = size_after(chain, i);
+
+		const ColorSpaceConversion* first_conversion = conversion_of(first);
+		const ColorSpaceConversion* second_conversion = conversion_of(second);
+		if (color_input() && first_conversion != nullptr && second_conversion != nullptr &&
+			inverse_conversions(*first_conversion, *second_conversion)) {
+			add_log(QString("Removed \"%1\" and \"%2\": they cancel out").arg(first.to_string(), second.to_string()),
+					operations({chain[i], chain[i + 1]}, size), 0);
+			chain.erase(chain.begin() + i, chain.begin() + i + 2);
+			color_rewritten = true;
+			return true;
+		}
+
+		// The first resize only feeds the second one. Two resizes by factors are left as they are,
+		// one resize by the product may round the size differently.
+		if (first.task_kind() == TaskKind::resize && second.task_kind() == TaskKind::resize) {
+			const auto& first_resize = static_cast<const TaskResizeDesc&>(first);
+			const auto& last_resize = static_cast<const TaskResizeDesc&>(second);
+			if (first_resize.scale != 0.0 && last_resize.scale != 0.0)
+				continue;
+
+			auto collapsed = std::make_shared<TaskResizeDesc>(last_resize.interpolation,
+															  last_resize.img_size_after(first_resize.size));
+			add_log(QString("Collapsed \"%1\" and \"%2\" into one resize").arg(first.to_string(), second.to_string()),
+					operations({chain[i], chain[i + 1]}, size), operations({collapsed}, size));
+			chain[i] = collapsed;
+			chain.erase(chain.begin() + i + 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool TaskChainOptimizer::fuse(std::vector<std::shared_ptr<TaskDesc>>& chain) {
+	// The networks process only the luma of the images with at least 3 channels.
+	if (!color_input())
+		return false;
+
+	for (size_t i = 0; i + 1 < chain.size(); i++) {
+		const TaskDesc& first = *chain[i];
+		const TaskDesc& second = *chain[i + 1];
+		const QSize size = size_after(chain, i);
+
+		// The network converts its input to YCbCr right back.
+		const ColorSpaceConversion* first_conversion = conversion_of(first);
+		if (first_conversion != nullptr && *first_conversion == ColorSpaceConversion::ycbcr_to_rgb &&
+			can_fuse(second, false)) {
+			auto fused = fused_copy(second, false);
+			add_log(QString("Fused \"%1\" into \"%2\"").arg(first.to_string(), second.to_string()),
+					operations({chain[i], chain[i + 1]}, size), operations({fused}, size));
+			chain[i] = fused;
+			chain.erase(chain.begin() + i + 1);
+			color_rewritten = true;
+			return true;
+		}
+
+		// The network converts its output from YCbCr just before.
+		const ColorSpaceConversion* second_conversion = conversion_of(second);
+		if (second_conversion != nullptr && *second_conversion == ColorSpaceConversion::rgb_to_ycbcr &&
+			can_fuse(first, true)) {
+			auto fused = fused_copy(first, true);
+			add_log(QString("Fused \"%1\" into \"%2\"").arg(second.to_string(), first.to_string()),
+					operations({chain[i], chain[i + 1]}, size), operations({fused}, size));
+			chain[i] = fused;
+			chain.erase(chain.begin() + i + 1);
+			color_rewritten = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+QSize TaskChainOptimizer::size_after(const std::vector<std::shared_ptr<TaskDesc>>& chain, size_t count) const {
+	QSize size = sample_size;
+	for (size_t i = 0; i < count && !size.isEmpty(); i++)
+		size = chain[i]->img_size_after(size);
+	return size;
+}
+
+unsigned long long TaskChainOptimizer::operations(const std::vector<std::shared_ptr<TaskDesc>>& tasks,
+												  QSize size) const {
+	if (size.isEmpty())
+		return 0;
+
+	unsigned long long result = 0;
+	for (const auto& task : tasks) {
+		result += func::task_operations_amount(*task, size, channels);
+		size = task->img_size_after(size);
+	}
+	return result;
+}
+
+void TaskChainOptimizer::add_log(const QString& rewrite, unsigned long long before, unsigned long long after) {
+	if (before <= after) {
+		log.append(rewrite);
+		return;
+	}
+
+	saved_operations += before - after;
+	log.append(QString("%1 (saves about %2 per image)").arg(
+		rewrite, func::operations_amount_to_string(before - after)));
+}
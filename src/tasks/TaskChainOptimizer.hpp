@@ -0,0 +1,74 @@
+/*
+ * ImageUpscalerQt - task chain optimizer header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QSize>
+#include <QStringList>
+
+#include "TaskDesc.hpp"
+
+/// Rewrites a chain of tasks before it runs, so it does less work for the same result:
+/// - adjacent inverse color space conversions (RGB to YCbCr and YCbCr to RGB, the same with YCoCg) cancel out;
+/// - consecutive resizes are collapsed into one to the final size with the interpolation of the last one;
+/// - YCbCr to RGB right before a luma-only neural network task and RGB to YCbCr right after it are fused
+///   into the task, which works in YCbCr anyway.
+/// The color space rewrites are made only for the images known to have at least 3 channels. With fewer
+/// the conversions fail and the networks process every channel, so removing the conversions would change that.
+/// The descriptions of the chain are never changed, the rewritten tasks get new ones.
+class TaskChainOptimizer {
+public:
+	/// @param sample_size Size of a typical input image for the estimates of the saved work, empty if unknown.
+	/// @param channels The fewest channels of the input images, 0 if unknown.
+	explicit TaskChainOptimizer(QSize sample_size = QSize(), int channels = 0);
+
+	std::vector<std::shared_ptr<TaskDesc>> optimize(const std::vector<std::shared_ptr<TaskDesc>>& chain);
+
+	/// What the last optimize() rewrote with the saved work, like "Removed "Convert from RGB to YCbCr" and
+	/// "Convert from YCbCr to RGB": they cancel out (saves about 18.00 MFLOP per image)". Empty if nothing.
+	QStringList get_log() const {
+		return log;
+	}
+
+	/// Arithmetic operations that the last optimize() saved on the sample image, 0 if it is unknown.
+	unsigned long long get_saved_operations() const {
+		return saved_operations;
+	}
+
+	/// Whether the last optimize() removed or fused any color space conversion.
+	bool get_color_rewritten() const {
+		return color_rewritten;
+	}
+
+private:
+	QSize sample_size;
+	int channels;
+	QStringList log;
+	unsigned long long saved_operations = 0;
+	bool color_rewritten = false;
+
+	/// Whether the color space conversions may be rewritten: the images have at least 3 channels.
+	bool color_input() const {
+		return channels >= 3;
+	}
+
+	/// Cancel the inverse conversions and collapse the resizes.
+	/// @returns true if anything was rewritten.
+	bool eliminate(std::vector<std::shared_ptr<TaskDesc>>& chain);
+	/// Fuse the color space conversions into the neural network tasks.
+	/// @returns true if anything was rewritten.
+	bool fuse(std::vector<std::shared_ptr<TaskDesc>>& chain);
+
+	/// Size of the sample image after the first count tasks of the chain.
+	QSize size_after(const std::vector<std::shared_ptr<TaskDesc>>& chain, size_t count) const;
+	/// Operations of the tasks one after another on the sample image of the size, 0 if the sample is unknown.
+	unsigned long long operations(const std::vector<std::shared_ptr<TaskDesc>>& tasks, QSize size) const;
+	/// Log the rewrite with the operations it saved.
+	void add_log(const QString& rewrite, unsigned long long before, unsigned long long after);
+};
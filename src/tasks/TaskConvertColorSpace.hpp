@@ -17,7 +17,7 @@ public:
 
 	float progress() const override;
 
-	OIIO::ImageBuf do_task(OIIO::ImageBuf input, std::function<void()> canceled) override;
+	PlanarImage do_task(PlanarImage&& input, std::function<void()> canceled) override;
 
 	const TaskDesc* get_desc() const override;
 
@@ -4,11 +4,24 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <algorithm>
+
 #include <QStringList>
 #include <QCoreApplication>
 
 #include "TaskDesc.hpp"
 
+/// ", YCbCr input and output" and so on for the color space conversions fused into a neural network task.
+QString fused_conversions_string(bool ycbcr_input, bool ycbcr_output) {
+	if (ycbcr_input && ycbcr_output)
+		return QCoreApplication::translate("ImageUpscalerQt", ", YCbCr input and output");
+	if (ycbcr_input)
+		return QCoreApplication::translate("ImageUpscalerQt", ", YCbCr input");
+	if (ycbcr_output)
+		return QCoreApplication::translate("ImageUpscalerQt", ", YCbCr output");
+	return QString();
+}
+
 // BEGIN SRCNN
 
 QString SRCNNDesc::to_string() const {
@@ -20,8 +33,21 @@ QString SRCNNDesc::to_string() const {
 										 QString::number(channels[2]));
 }
 
+int SRCNNDesc::halo() const {
+	// Every layer pads its input by (kernel - 1) / 2.
+	int result = 0;
+	for (unsigned short kernel : kernels)
+		result += (kernel - 1) / 2;
+	return result;
+}
+
 QString TaskSRCNNDesc::to_string() const {
-	return QCoreApplication::translate("ImageUpscalerQt", "Use SRCNN %1").arg(srcnn_desc.to_string());
+	QString result = luma_only ?
+		QCoreApplication::translate("ImageUpscalerQt", "Use SRCNN %1 on luma").arg(srcnn_desc.to_string()) :
+		QCoreApplication::translate("ImageUpscalerQt", "Use SRCNN %1").arg(srcnn_desc.to_string());
+	if (precision != Precision::f32)
+		result += QString(" (%1)").arg(PRECISION_NAMES[static_cast<unsigned char>(precision)]);
+	return result + fused_conversions_string(luma_only && ycbcr_input, luma_only && ycbcr_output);
 }
 
 QSize TaskSRCNNDesc::img_size_after(QSize cur_size) const {
@@ -136,12 +162,32 @@ QString FSRCNNDesc::to_string(bool with_multiplier) const {
 }
 		;
 
+int FSRCNNDesc::halo() const {
+	// Convolutions pad theirs input by (kernel - 1) / 2.
+	int result = 0;
+	for (size_t i = 0; i + 1 < kernels.size(); i++)
+		result += (kernels[i] - 1) / 2;
+
+	// The deconvolution (see FSRCNN::init_pads()) takes the output pixels of an input pixel
+	// from kernel - 1 - pad_l input pixels on the left and pad_l + multiplier - 1 on the right.
+	const int kernel = kernels.back();
+	const int pad_l = (kernel - size_multiplier) / 2;
+	const int left = (kernel - 1 - pad_l) / size_multiplier;
+	const int right = (pad_l + size_multiplier - 1) / size_multiplier;
+	return result + std::max(left, right);
+}
+
 QString TaskFSRCNNDesc::to_string() const {
-	return QCoreApplication::translate("ImageUpscalerQt", "Use FSRCNN %1").arg(fsrcnn_desc.to_string());
+	QString result = luma_only ?
+		QCoreApplication::translate("ImageUpscalerQt", "Use FSRCNN %1 on luma").arg(fsrcnn_desc.to_string()) :
+		QCoreApplication::translate("ImageUpscalerQt", "Use FSRCNN %1").arg(fsrcnn_desc.to_string());
+	if (precision != Precision::f32)
+		result += QString(" (%1)").arg(PRECISION_NAMES[static_cast<unsigned char>(precision)]);
+	return result + fused_conversions_string(luma_only && ycbcr_input, luma_only && ycbcr_output);
 }
 
 QSize TaskFSRCNNDesc::img_size_after(QSize cur_size) const {
-	return cur_size * 3;
+	return cur_size * fsrcnn_desc.size_multiplier;
 }
 
 bool FSRCNNDesc::from_string(QString str, FSRCNNDesc* desc) {
@@ -247,13 +293,18 @@ bool FSRCNNDesc::operator==(const FSRCNNDesc& right) const {
 // END FSRCNN
 
 QString TaskResizeDesc::to_string() const {
+	if (scale != 0.0) {
+		return QString("Resize x%1 | %2").arg(QString::number(scale, 'g', 4),
+											  INTERPOLATION_NAMES[static_cast<unsigned char>(interpolation)]);
+	}
+
 	return QString("Resize to %1x%2 | %3").arg(QString::number(size.width()),
 											   QString::number(size.height()),
 											   INTERPOLATION_NAMES[static_cast<unsigned char>(interpolation)]);
 }
 
-QSize TaskResizeDesc::img_size_after(QSize) const {
-	return size;
+QSize TaskResizeDesc::img_size_after(QSize cur_size) const {
+	return scale != 0.0 ? cur_size * scale : size;
 }
 
 
@@ -267,3 +318,20 @@ QString TaskConvertColorSpaceDesc::to_string() const {
 QSize TaskConvertColorSpaceDesc::img_size_after(QSize cur_size) const {
 	return cur_size;
 }
+
+QString TaskUpscaleDesc::to_string() const {
+	const QString target = scale != 0.0 ? QString("x%1").arg(QString::number(scale, 'g', 4)) :
+		QString("to %1x%2").arg(QString::number(size.width()), QString::number(size.height()));
+	QString result = QCoreApplication::translate("ImageUpscalerQt", "Upscale %1, %2 quality").arg(
+		target, QCoreApplication::translate("ImageUpscalerQt",
+		UPSCALE_QUALITY_NAMES[static_cast<unsigned char>(quality)]));
+	if (luma_only)
+		result += QCoreApplication::translate("ImageUpscalerQt", ", luma");
+	if (precision != Precision::f32)
+		result += QString(" (%1)").arg(PRECISION_NAMES[static_cast<unsigned char>(precision)]);
+	return result;
+}
+
+QSize TaskUpscaleDesc::img_size_after(QSize cur_size) const {
+	return scale != 0.0 ? cur_size * scale : size;
+}
@@ -16,7 +16,9 @@ enum class TaskKind : unsigned char {
 	resize,
 	convert_color_space,
 	srcnn,
-	fsrcnn
+	fsrcnn,
+	/// Runs the chain that UpscalePlanner plans for the size of every image (see TaskUpscale).
+	upscale
 };
 
 enum class Interpolation : unsigned char {
@@ -49,6 +51,31 @@ const char* const COLOR_SPACE_CONVERSION_NAMES[4] = {
 	"RGB to YCbCr", "YCbCr to RGB", "RGB to YCoCg", "YCoCg to RGB"
 };
 
+/// Data type of the neural network computations.
+/// int8 needs a quantized model (see the calibrate tool).
+enum class Precision : unsigned char {
+	f32, bf16, int8
+};
+
+/// Precision names for the user.
+const char* const PRECISION_NAMES[3] = {
+	"f32", "bf16", "int8"
+};
+
+/// Quality floor of the upscale task: how much of the enlargement may be left to the interpolation,
+/// how narrow the neural networks may be and which filters may be used (see UpscalePlanner).
+enum class UpscaleQuality : unsigned char {
+	low, medium, high
+};
+
+/// Upscale quality names for the user.
+const char* const UPSCALE_QUALITY_NAMES[3] = {
+	"low", "medium", "high"
+};
+
+/// Block size of the neural network tasks that means "choose for every image" (see func::auto_block_size).
+constexpr int AUTO_BLOCK_SIZE = -1;
+
 struct TaskDesc {
 	virtual ~TaskDesc() = default;
 
@@ -57,17 +84,29 @@ struct TaskDesc {
 	virtual QSize img_size_after(QSize cur_size) const = 0;
 
 	virtual TaskKind task_kind() const = 0;
+
+	/// How many rows above and below a strip of the image affect the result of the strip.
+	/// -1 if the task can't process the image strip by strip.
+	virtual int strip_halo() const {
+		return -1;
+	}
 };
 
 struct TaskResizeDesc : TaskDesc {
 	Interpolation interpolation = Interpolation::bilinear;
 	QSize size;
+	/// If not 0, the image is resized by this factor and the size is ignored,
+	/// so images of different sizes keep theirs aspect ratios.
+	double scale = 0.0;
 
 	TaskResizeDesc() = default;
 
 	TaskResizeDesc(Interpolation interpolation, QSize size) :
 		interpolation(interpolation), size(size) {}
 
+	TaskResizeDesc(Interpolation interpolation, double scale) :
+		interpolation(interpolation), scale(scale) {}
+
 	~TaskResizeDesc() = default;
 
 	QString to_string() const override;
@@ -96,6 +135,10 @@ struct TaskConvertColorSpaceDesc : TaskDesc {
 	TaskKind task_kind() const override {
 		return TaskKind::convert_color_space;
 	}
+
+	int strip_halo() const override {
+		return 0;
+	}
 };
 
 struct SRCNNDesc {
@@ -109,6 +152,9 @@ struct SRCNNDesc {
 			  kernels(kernels), channels(channels) {}
 
 	QString to_string() const;
+	/// Radius of the receptive field: how many input pixels around a pixel affect it.
+	/// Blocks are processed with a halo of this width, so they don't have seams.
+	int halo() const;
 	/// Parse SRCNN. Returns true if parsing is successful.
 	/// Returns false if it is impossible to parse.
 	/// Pass nullptr as pointer for desc to validate if it is valid SRCNN description string.
@@ -122,16 +168,30 @@ struct SRCNNDesc {
 struct TaskSRCNNDesc : TaskDesc {
 	SRCNNDesc srcnn_desc;
 	/// Block size of the input image that will be splitted into blocks before the CNN.
-	/// 0 if the input image have not to be splitted.
+	/// 0 if the input image have not to be splitted, AUTO_BLOCK_SIZE to choose it for every image.
+	/// Every block goes through the CNN with the halo around it, so the result doesn't depend on the block size.
 	int block_size;
-
-	TaskSRCNNDesc(const SRCNNDesc& srcnn_desc, unsigned int block_size) :
-				  srcnn_desc(srcnn_desc), block_size(block_size) {}
+	/// Run the CNN only on the luma (Y of YCbCr), chroma and the other channels are resized.
+	/// Applies only to images with 3 or more channels.
+	bool luma_only;
+	/// Requested precision. f32 is used if the CPU doesn't support it.
+	Precision precision;
+	/// In the luma-only mode, the input is already in YCbCr and the output stays in YCbCr. Set by the chain
+	/// optimizer, which fuses the adjacent color space conversions into the task (see TaskChainOptimizer).
+	bool ycbcr_input = false;
+	bool ycbcr_output = false;
+
+	TaskSRCNNDesc(const SRCNNDesc& srcnn_desc, int block_size, bool luma_only = false,
+				  Precision precision = Precision::f32) :
+				  srcnn_desc(srcnn_desc), block_size(block_size), luma_only(luma_only), precision(precision) {}
 
 	TaskSRCNNDesc(std::array<unsigned short, 3> kernels,
 				  std::array<unsigned short, 4> channels,
-				  unsigned int block_size) :
-				  srcnn_desc(kernels, channels), block_size(block_size) {}
+				  int block_size,
+				  bool luma_only = false,
+				  Precision precision = Precision::f32) :
+				  srcnn_desc(kernels, channels), block_size(block_size), luma_only(luma_only),
+				  precision(precision) {}
 
 	~TaskSRCNNDesc() = default;
 
@@ -142,6 +202,10 @@ struct TaskSRCNNDesc : TaskDesc {
 	TaskKind task_kind() const override {
 		return TaskKind::srcnn;
 	}
+
+	int strip_halo() const override {
+		return srcnn_desc.halo();
+	}
 };
 
 struct FSRCNNDesc {
@@ -157,6 +221,9 @@ struct FSRCNNDesc {
 			   kernels(kernels), channels(channels), size_multiplier(size_multiplier) {}
 
 	QString to_string(bool with_multiplier = true) const;
+	/// Radius of the receptive field in the input pixels: how many input pixels around a pixel
+	/// affect the output pixels made of it. Blocks are processed with a halo of this width, so they don't have seams.
+	int halo() const;
 	/// Parse FSRCNN. Returns true if parsing is successful.
 	/// Returns false if it is impossible to parse.
 	/// Pass nullptr as pointer for desc to validate if it is valid FSRCNN description string.
@@ -170,29 +237,38 @@ struct FSRCNNDesc {
 struct TaskFSRCNNDesc : TaskDesc {
 	FSRCNNDesc fsrcnn_desc;
 	/// Block size of the input image that will be splitted into blocks before the CNN.
-	/// 0 if the input image have not to be splitted.
-	unsigned int block_size;
-	/// Margin for every block (even if input image must not be splitted).
-	/// Positive value creates gaps between the blocks with width of margin * 2.
-	/// Negative value crops pixels around the borders in every block.
-	/// Usually used to remove artifacts around the borders.
-	int margin;
+	/// 0 if the input image have not to be splitted, AUTO_BLOCK_SIZE to choose it for every image.
+	/// Every block goes through the CNN with the halo around it, so the result doesn't depend on the block size.
+	int block_size;
+	/// Run the CNN only on the luma (Y of YCbCr), chroma and the other channels are resized.
+	/// Applies only to images with 3 or more channels.
+	bool luma_only;
+	/// Requested precision. f32 is used if the CPU doesn't support it.
+	Precision precision;
+	/// In the luma-only mode, the input is already in YCbCr and the output stays in YCbCr. Set by the chain
+	/// optimizer, which fuses the adjacent color space conversions into the task (see TaskChainOptimizer).
+	bool ycbcr_input = false;
+	bool ycbcr_output = false;
 
 	TaskFSRCNNDesc(const FSRCNNDesc& fsrcnn_desc,
-				   unsigned int block_size,
-				   int margin = 0) :
+				   int block_size,
+				   bool luma_only = false,
+				   Precision precision = Precision::f32) :
 				   fsrcnn_desc(fsrcnn_desc),
 				   block_size(block_size),
-				   margin(margin) {};
+				   luma_only(luma_only),
+				   precision(precision) {};
 
 	TaskFSRCNNDesc(const std::vector<unsigned short>& kernels,
 				   const std::vector<unsigned short>& channels,
 				   unsigned char size_multiplier,
-				   unsigned int block_size,
-				   int margin = 0) :
+				   int block_size,
+				   bool luma_only = false,
+				   Precision precision = Precision::f32) :
 				   fsrcnn_desc(kernels, channels, size_multiplier),
 				   block_size(block_size),
-				   margin(margin) {};
+				   luma_only(luma_only),
+				   precision(precision) {};
 
 	~TaskFSRCNNDesc() = default;
 
@@ -203,4 +279,38 @@ struct TaskFSRCNNDesc : TaskDesc {
 	TaskKind task_kind() const override {
 		return TaskKind::fsrcnn;
 	}
+
+	int strip_halo() const override {
+		// The chroma filter of the luma mode reads a bit further.
+		return fsrcnn_desc.halo() + (luma_only ? 2 : 0);
+	}
+};
+
+/// Upscale to the size (or by the factor) with the cheapest chain of the neural networks and the resizes
+/// that meets the quality floor. TaskUpscale plans it for the size of every image.
+/// Only the command line creates it, the task creation dialog has no page for it.
+struct TaskUpscaleDesc : TaskDesc {
+	/// Target size, ignored if the scale is not 0.
+	QSize size;
+	double scale = 0.0;
+	UpscaleQuality quality = UpscaleQuality::medium;
+	/// Settings of the planned neural network tasks.
+	int block_size = 0;
+	bool luma_only = false;
+	Precision precision = Precision::f32;
+
+	TaskUpscaleDesc(QSize size, double scale, UpscaleQuality quality, int block_size = 0,
+					bool luma_only = false, Precision precision = Precision::f32) :
+					size(size), scale(scale), quality(quality), block_size(block_size),
+					luma_only(luma_only), precision(precision) {}
+
+	~TaskUpscaleDesc() = default;
+
+	QString to_string() const override;
+
+	QSize img_size_after(QSize cur_size) const override;
+
+	TaskKind task_kind() const override {
+		return TaskKind::upscale;
+	}
 };
@@ -6,132 +6,220 @@
 
 #include <sstream>
 #include <memory>
+#include <utility>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <vector>
 
 #include <QDir>
-#include <QFile>
+#include <QPoint>
 #include <OpenImageIO/imagebufalgo.h>
 
 #include "TaskFSRCNN.hpp"
-#include "../nn/FSRCNN.hpp"
+#include "../nn/NetworkCache.hpp"
 #include "../functions/func.hpp"
 
+/// OpenImageIO filter for the chroma in the luma-only mode.
+const char* const CHROMA_FILTER = "triangle";
+
 TaskFSRCNN::TaskFSRCNN(const TaskFSRCNNDesc& desc) : desc(desc) {}
 
 float TaskFSRCNN::progress() const {
-	return static_cast<float>(blocks_processed) / blocks_amount;
+	const long long amount = blocks_amount;
+	return amount == 0 ? 0.0f : static_cast<float>(blocks_processed) / amount;
 }
 
-OIIO::ImageBuf TaskFSRCNN::do_task(OIIO::ImageBuf input, std::function<void()> canceled) {
+QString TaskFSRCNN::status() const {
+	const int block_size = chosen_block_size;
+	if (block_size == -1 || block_size == desc.block_size)
+		return QString();
+
+	const QString reason = desc.block_size == AUTO_BLOCK_SIZE ? "chosen automatically" :
+		"reduced to fit the memory budget";
+	if (block_size == 0)
+		return "whole image (" + reason + ")";
+	return QString("block %1x%1 (%2)").arg(block_size).arg(reason);
+}
+
+PlanarImage TaskFSRCNN::do_task(PlanarImage&& input, std::function<void()> canceled) {
+	network_construction_ms = 0.0;
+	network_execution_ms = 0.0;
+
+	if (desc.luma_only && input.channels() >= 3)
+		return do_task_luma(std::move(input), canceled);
+
 	const unsigned char& mul = desc.fsrcnn_desc.size_multiplier;
-	const int& margin = desc.margin;
 
-	// Get spec.
-	auto spec = input.spec();
-	// Whole image size if we don't have to split image into blocks.
-	const int block_width = desc.block_size == 0 ? spec.width : desc.block_size;
-	const int block_height = desc.block_size == 0 ? spec.height : desc.block_size;
+	// Create the output image.
+	PlanarImage output(input.width() * mul, input.height() * mul, input.channels());
 
-	// Create the output buffer.
-	const OIIO::ImageSpec out_spec(spec.width * mul, spec.height * mul, spec.nchannels);
-	OIIO::ImageBuf output(out_spec);
+	if (!upscale_channels(input, output, 0, input.channels())) {
+		canceled();
+		return std::move(input);
+	}
 
-	blocks_amount = func::blocks_amount(QSize(spec.width, spec.height),
-										QSize(block_width, block_height), margin) * spec.nchannels;
-	blocks_processed = 0;
+	return output;
+}
+
+PlanarImage TaskFSRCNN::do_task_luma(PlanarImage&& input, std::function<void()> canceled) {
+	const unsigned char& mul = desc.fsrcnn_desc.size_multiplier;
 
-	// Initialize the neural network.
-	FSRCNN nn = FSRCNN(block_width - margin * 2, block_height - margin * 2, desc.fsrcnn_desc);
-	const std::vector<dnnl::memory::desc> ker_descs = nn.get_ker_descs();
-	const std::vector<dnnl::memory::desc> bias_descs = nn.get_bias_descs();
-	const dnnl::memory::desc input_desc = nn.get_input_desc();
-	const dnnl::memory::desc output_desc = nn.get_output_desc();
-	const dnnl::engine eng = nn.get_engine();
-	assert(ker_descs.size() == bias_descs.size());
-
-	// Initialize full kernel and bias sizes in bytes.
-	std::vector<size_t> full_ker_sizes(ker_descs.size());
-	std::vector<size_t> full_bias_sizes(ker_descs.size());
-	size_t total_params_size = 0;
-	for (char i = 0; i < ker_descs.size(); i++) {
-		full_ker_sizes[i] = ker_descs[i].get_size();
-		full_bias_sizes[i] = bias_descs[i].get_size();
-		total_params_size += full_ker_sizes[i] + full_bias_sizes[i];
+	// Convert the color planes of the input to YCbCr in place, unless they already are.
+	float* const color_planes[3] = {input.plane(0), input.plane(1), input.plane(2)};
+	if (!desc.ycbcr_input)
+		func::convert_color_space(ColorSpaceConversion::rgb_to_ycbcr, color_planes, input.plane_size());
+
+	// The output stays in YCbCr until the end. The neural network fills Y only.
+	PlanarImage output(input.width() * mul, input.height() * mul, input.channels());
+	if (!upscale_channels(input, output, 0, 1)) {
+		if (!desc.ycbcr_input)
+			func::convert_color_space(ColorSpaceConversion::ycbcr_to_rgb, color_planes, input.plane_size());
+		canceled();
+		return std::move(input);
 	}
 
-	// Load file with parameters from resources.
-	QFile file(":/fsrcnn/" + desc.fsrcnn_desc.to_string() + ".bin");
-	file.open(QFile::ReadOnly);
-	QByteArray file_array = file.read(512 * 1024 * 1024); //Maximum size is 512 MiB
-	assert(file_array.size() == total_params_size);
-
-	// Load this array into dnnl::memory.
-	std::vector<dnnl::memory> ker_mems(ker_descs.size());
-	std::vector<dnnl::memory> bias_mems(bias_descs.size());
-	size_t mem_offset = 0;
-	for (char i = 0; i < ker_descs.size(); i++) {
-		ker_mems[i] = dnnl::memory(ker_descs[i], eng, file_array.data() + mem_offset);
-		mem_offset += full_ker_sizes[i];
-		bias_mems[i] = dnnl::memory(bias_descs[i], eng, file_array.data() + mem_offset);
-		mem_offset += full_bias_sizes[i];
+	// Chroma and the other channels (like alpha) are resized with a cheap filter.
+	for (int c = 1; c < input.channels(); c++) {
+		OIIO::ImageBuf dst = output.plane_buf(c);
+		OIIO::ImageBufAlgo::resize(dst, input.plane_buf(c), CHROMA_FILTER, 0.0f, dst.roi());
 	}
+	input = PlanarImage();
 
-	// Use FSRCNN block by block.
-	for (int y = 0; y < spec.height; y += block_height + margin * 2) {
-		for (int x = 0; x < spec.width; x += block_width + margin * 2) {
-			for (int c = 0; c < spec.nchannels; c++) {
-				// Create block roi.
-				OIIO::ROI block_roi_input(x + margin,
-										  x - margin + block_width,
-										  y + margin,
-										  y - margin + block_height,
-										  0, 1, c, c + 1);
-
-				// Get block pixels. Planar, because we are working on single-channel image.
-				auto block_pixels = std::make_unique<float[]>(
-					(block_width - margin * 2) * (block_height - margin * 2) * 1
-				);
-				input.get_pixels(block_roi_input, OIIO::TypeDesc::FLOAT, block_pixels.get());
-
-				// Create input memory.
-				dnnl::memory input_mem = dnnl::memory(input_desc, eng, block_pixels.get());
-				// Create output memory.
-				dnnl::memory output_mem = dnnl::memory(output_desc, eng);
-				// Get output from the neural network.
-				nn.execute(input_mem, ker_mems, bias_mems, output_mem);
-
-				// Set pixels to buf.
-				const OIIO::ROI block_roi_net_output((x + margin) * mul, (x - margin + block_width) * mul,
-					(y + margin) * mul, (y - margin + block_height) * mul,
-					0, 1, c, c + 1);
-				if (margin == 0) {
-					output.set_pixels(block_roi_net_output, OIIO::TypeDesc::FLOAT, output_mem.get_data_handle());
-				}
-				else {
-					OIIO::ROI block_roi(0, block_roi_net_output.width(),
-										0, block_roi_net_output.height(),
-										0, 1, 0, 1);
-					OIIO::ImageSpec block_spec(block_roi, OIIO::TypeDesc::FLOAT);
-					OIIO::ImageBuf block(block_spec, output_mem.get_data_handle());
-
-					OIIO::ROI marginated_block_roi(-margin * mul, (block_width + margin) * mul,
-												   -margin * mul, (block_height + margin) * mul,
-												   0, 1, 0, 1);
-					OIIO::ImageBufAlgo::paste(output, x * mul, y * mul, 0, c, block, marginated_block_roi);
-				}
+	if (!desc.ycbcr_output) {
+		float* const output_planes[3] = {output.plane(0), output.plane(1), output.plane(2)};
+		func::convert_color_space(ColorSpaceConversion::ycbcr_to_rgb, output_planes, output.plane_size());
+	}
+	return output;
+}
+
+bool TaskFSRCNN::upscale_channels(const PlanarImage& input, PlanarImage& output, int chbegin, int chend) {
+	const unsigned char& mul = desc.fsrcnn_desc.size_multiplier;
+
+	const int width = input.width();
+	const int height = input.height();
+	const int channels = chend - chbegin;
+	// Blocks and minibatches, reduced if the Worker limited the memory.
+	const func::CNNBlocks plan = func::cnn_blocks(desc.fsrcnn_desc, QSize(width, height), desc.block_size,
+												  channels, network_memory_limit);
+	const int block_size = plan.block_size;
+	chosen_block_size = block_size;
+	// Whole image size if we don't have to split image into blocks.
+	const int block_width = block_size == 0 ? width : std::min(block_size, width);
+	const int block_height = block_size == 0 ? height : std::min(block_size, height);
+
+	// Blocks go through the neural network with the halo around them (clipped by the image),
+	// so every output pixel sees the same input as with the whole image. Windows at the
+	// borders are moved inside the image, so all of them have the same size.
+	const int halo = desc.fsrcnn_desc.halo();
+	const int window_width = plan.window.width();
+	const int window_height = plan.window.height();
+
+	blocks_amount = func::blocks_amount(QSize(width, height),
+										QSize(block_width, block_height)) * channels;
+	blocks_processed = 0;
+
+	// Every channel of a block is a separate item of the minibatch.
+	const long long window_pixels_amount = static_cast<long long>(window_width) * window_height;
+	const long long out_window_pixels_amount = window_pixels_amount * mul * mul;
+	const int blocks_per_batch = plan.blocks_per_batch;
+	// Batches of one block (large blocks and whole images) are read and written right in the planes.
+	// Smaller blocks are packed into the minibatches by copying.
+	const bool views = blocks_per_batch == 1;
+
+	std::vector<QPoint> blocks;
+	for (int y = 0; y < height; y += block_height) {
+		for (int x = 0; x < width; x += block_width)
+			blocks.emplace_back(x, y);
+	}
 
-				blocks_processed++;
+	const auto window_origin = [&](const QPoint& block) {
+		return QPoint(std::clamp(block.x() - halo, 0, width - window_width),
+					  std::clamp(block.y() - halo, 0, height - window_height));
+	};
+
+	// Use FSRCNN batch by batch.
+	std::shared_ptr<FSRCNN> nn;
+	int nn_batch = 0;
+	for (size_t first = 0; first < blocks.size(); first += blocks_per_batch) {
+		const int batch_blocks = std::min<size_t>(blocks_per_batch, blocks.size() - first);
+		const int batch = batch_blocks * channels;
+
+		// Take the neural network with its parameters from the cache.
+		// Only the last batch may need another one.
+		if (batch != nn_batch) {
+			const auto acquire_start = std::chrono::steady_clock::now();
+			nn = NetworkCache::instance().acquire_fsrcnn(desc.fsrcnn_desc, QSize(window_width, window_height),
+																batch, desc.precision);
+			network_construction_ms += func::elapsed_ms(acquire_start);
+			nn_batch = batch;
+		}
+
+		if (views) {
+			// The only block of the batch: the network reads the window right from the planes
+			// and writes the upscaled block right into the output planes.
+			const QPoint& block = blocks[first];
+			const QPoint window = window_origin(block);
+			// The network only reads the input view.
+			const PlaneView src{const_cast<float*>(input.row(chbegin, window.y())) + window.x(),
+								static_cast<dnnl::memory::dim>(input.plane_size()),
+								static_cast<dnnl::memory::dim>(input.row_stride())};
+			const PlaneView dest{output.row(chbegin, block.y() * mul) + block.x() * mul,
+								 static_cast<dnnl::memory::dim>(output.plane_size()),
+								 static_cast<dnnl::memory::dim>(output.row_stride())};
+
+			const auto execute_start = std::chrono::steady_clock::now();
+			nn->execute(src, dest, (std::min(block.y() + block_height, height) - block.y()) * mul,
+						(std::min(block.x() + block_width, width) - block.x()) * mul,
+						(block.y() - window.y()) * mul, (block.x() - window.x()) * mul);
+			network_execution_ms += func::elapsed_ms(execute_start);
+		}
+		else {
+			// Planar pixels of all windows of the batch go into the input memory of the network.
+			float* window_pixels = static_cast<float*>(nn->get_input_memory().get_data_handle());
+
+			// Copy the window rows of every channel.
+			for (int b = 0; b < batch_blocks; b++) {
+				const QPoint window = window_origin(blocks[first + b]);
+				for (int c = chbegin; c < chend; c++) {
+					float* dest = window_pixels + (b * channels + c - chbegin) * window_pixels_amount;
+					for (int y = 0; y < window_height; y++)
+						std::copy_n(input.row(c, window.y() + y) + window.x(), window_width, dest + y * window_width);
+				}
+			}
 
-				// Cancel if requested.
-				if (cancel_requested) {
-					canceled();
-					return input;
+			// Get output from the neural network.
+			const auto execute_start = std::chrono::steady_clock::now();
+			nn->execute();
+			network_execution_ms += func::elapsed_ms(execute_start);
+
+			// Copy only the upscaled block rows (without the halo) to the output.
+			const float* output_pixels = static_cast<const float*>(nn->get_output_memory().get_data_handle());
+			const int out_window_width = window_width * mul;
+			for (int b = 0; b < batch_blocks; b++) {
+				const QPoint& block = blocks[first + b];
+				const QPoint window = window_origin(block);
+				const int out_block_width = (std::min(block.x() + block_width, width) - block.x()) * mul;
+				const int out_block_end_y = std::min(block.y() + block_height, height) * mul;
+				for (int c = chbegin; c < chend; c++) {
+					const float* src = output_pixels + (b * channels + c - chbegin) * out_window_pixels_amount +
+						(block.x() - window.x()) * mul;
+					for (int y = block.y() * mul; y < out_block_end_y; y++) {
+						std::copy_n(src + static_cast<long long>(y - window.y() * mul) * out_window_width, out_block_width,
+									output.row(c, y) + block.x() * mul);
+					}
 				}
 			}
 		}
+
+		blocks_processed += batch;
+
+		// Cancel if requested.
+		if (cancel_requested)
+			return false;
 	}
 
-	return output;
+	return true;
 }
 
 const TaskDesc* TaskFSRCNN::get_desc() const {
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 
 #include "Task.hpp"
 #include "TaskDesc.hpp"
@@ -19,11 +20,23 @@ public:
 
 	float progress() const override;
 
-	OIIO::ImageBuf do_task(const OIIO::ImageBuf input, std::function<void()> canceled) override;
+	QString status() const override;
+
+	PlanarImage do_task(PlanarImage&& input, std::function<void()> canceled) override;
 
 	const TaskDesc* get_desc() const override;
 
 private:
-	long long blocks_amount = 0;
-	long long blocks_processed = 0;
+	// Written by do_task() and read by progress() and status() from the GUI thread.
+	std::atomic<long long> blocks_amount = 0;
+	std::atomic<long long> blocks_processed = 0;
+	/// Block size used for the current image (chosen automatically or reduced to fit
+	/// the memory limit), -1 before the first image.
+	std::atomic<int> chosen_block_size = -1;
+
+	/// Run the CNN only on Y of YCbCr and resize the chroma.
+	PlanarImage do_task_luma(PlanarImage&& input, std::function<void()> canceled);
+	/// Run the CNN on the channels [chbegin, chend) of the input and write them to the same channels of the output.
+	/// @returns false if cancelled.
+	bool upscale_channels(const PlanarImage& input, PlanarImage& output, int chbegin, int chend);
 };
@@ -9,25 +9,28 @@
 #include <OpenImageIO/imagebufalgo.h>
 
 #include "TaskResize.hpp"
+#include "../functions/func.hpp"
 
 TaskResize::TaskResize(TaskResizeDesc desc) : desc(desc) {}
 
-OIIO::ImageBuf TaskResize::do_task(OIIO::ImageBuf input, std::function<void()> canceled) {
-	// Create ROI.
-	OIIO::ROI output_roi = OIIO::ROI(0, desc.size.width(), 0, desc.size.height(), 0, 1, 0, input.nchannels());
+PlanarImage TaskResize::do_task(PlanarImage&& input, std::function<void()> canceled) {
+	const QSize size = desc.img_size_after(QSize(input.width(), input.height()));
+	PlanarImage output(size.width(), size.height(), input.channels());
 
-	// Resize it.
-	OIIO::ImageBuf output;
-	switch (desc.interpolation) {
-		case Interpolation::bilinear: {
-			output = OIIO::ImageBufAlgo::resample(input, true, output_roi);
-			break;
-		}
-		default: {
-			output = OIIO::ImageBufAlgo::resize(input,
-				INTERPOLATION_OIIO_NAMES[static_cast<unsigned char>(desc.interpolation)],
-				0.0f, output_roi);
+	// The common filters are resized natively.
+	if (func::native_resampling(desc.interpolation)) {
+		for (int c = 0; c < input.channels(); c++) {
+			func::resample(input.plane(c), input.width(), input.height(), input.row_stride(),
+						   output.plane(c), output.width(), output.height(), output.row_stride(), desc.interpolation);
 		}
+		return output;
+	}
+
+	// The others go through OpenImageIO plane by plane. The buffers wrap the planes, nothing is copied.
+	for (int c = 0; c < input.channels(); c++) {
+		OIIO::ImageBuf dst = output.plane_buf(c);
+		OIIO::ImageBufAlgo::resize(dst, input.plane_buf(c),
+			INTERPOLATION_OIIO_NAMES[static_cast<unsigned char>(desc.interpolation)], 0.0f, dst.roi());
 	}
 
 	// Return result.
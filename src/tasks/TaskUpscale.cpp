@@ -0,0 +1,104 @@
+/*
+ * ImageUpscalerQt - upscale task
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <utility>
+
+#include "TaskUpscale.hpp"
+#include "TaskResize.hpp"
+#include "TaskSRCNN.hpp"
+#include "TaskFSRCNN.hpp"
+
+TaskUpscale::TaskUpscale(const TaskUpscaleDesc& desc, Planner planner) : desc(desc), planner(std::move(planner)) {}
+
+float TaskUpscale::progress() const {
+	const Chain* chain = cur_chain;
+	if (chain == nullptr || chain->tasks.empty())
+		return 0.0f;
+
+	const int task = cur_task;
+	return (task + chain->tasks[task]->progress()) / chain->tasks.size();
+}
+
+QString TaskUpscale::status() const {
+	const Chain* chain = cur_chain;
+	if (chain == nullptr || chain->tasks.empty())
+		return QString();
+
+	const int task = cur_task;
+	QString result = QString("%1 (stage %2/%3)").arg(chain->tasks[task]->get_desc()->to_string(),
+		QString::number(task + 1), QString::number(chain->tasks.size()));
+	const QString task_status = chain->tasks[task]->status();
+	if (!task_status.isEmpty())
+		result += ", " + task_status;
+	return result;
+}
+
+void TaskUpscale::set_cancel_requested(bool requested) {
+	cancel_requested = requested;
+	if (Chain* chain = cur_chain) {
+		for (const auto& task : chain->tasks)
+			task->set_cancel_requested(requested);
+	}
+}
+
+PlanarImage TaskUpscale::do_task(PlanarImage&& input, std::function<void()> canceled) {
+	network_construction_ms = 0.0;
+	network_execution_ms = 0.0;
+
+	Chain& chain = this->chain(input);
+	cur_task = 0;
+	cur_chain = &chain;
+
+	PlanarImage result = std::move(input);
+	for (int i = 0; i < chain.tasks.size(); i++) {
+		Task& task = *chain.tasks[i];
+		cur_task = i;
+		task.set_cancel_requested(cancel_requested);
+		task.network_memory_limit = network_memory_limit;
+
+		// The image is handed over to the task without copying.
+		result = task.do_task(std::move(result), canceled);
+		network_construction_ms += task.network_construction_ms;
+		network_execution_ms += task.network_execution_ms;
+
+		if (cancel_requested)
+			break;
+	}
+
+	return result;
+}
+
+const TaskDesc* TaskUpscale::get_desc() const {
+	return dynamic_cast<const TaskDesc*>(&desc);
+}
+
+TaskUpscale::Chain& TaskUpscale::chain(const PlanarImage& input) {
+	const auto key = std::make_tuple(input.width(), input.height(), input.channels());
+	auto iter = chains.find(key);
+	if (iter != chains.end())
+		return iter->second;
+
+	Chain result;
+	result.plan = planner(QSize(input.width(), input.height()), input.channels());
+	for (const auto& task_desc : result.plan.tasks) {
+		switch (task_desc->task_kind()) {
+		case TaskKind::resize:
+			result.tasks.push_back(std::make_unique<TaskResize>(static_cast<const TaskResizeDesc&>(*task_desc)));
+			break;
+		case TaskKind::srcnn:
+			result.tasks.push_back(std::make_unique<TaskSRCNN>(static_cast<const TaskSRCNNDesc&>(*task_desc)));
+			break;
+		case TaskKind::fsrcnn:
+			result.tasks.push_back(std::make_unique<TaskFSRCNN>(static_cast<const TaskFSRCNNDesc&>(*task_desc)));
+			break;
+		default:
+			// The planner makes only the resizes and the neural networks.
+			break;
+		}
+	}
+
+	return chains.emplace(key, std::move(result)).first->second;
+}
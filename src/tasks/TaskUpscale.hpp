@@ -0,0 +1,59 @@
+/*
+ * ImageUpscalerQt - upscale task header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "Task.hpp"
+#include "TaskDesc.hpp"
+#include "UpscalePlanner.hpp"
+
+/// Runs the chain planned by UpscalePlanner for the size of every input image. The chains are kept
+/// by the size, so the images of one size reuse the plan and the tasks (and theirs neural networks).
+class TaskUpscale : public Task {
+public:
+	/// Plan of the task for the image of the size and channels.
+	using Planner = std::function<UpscalePlanner::Plan(QSize size, int channels)>;
+
+	TaskUpscaleDesc desc;
+
+	/// @param planner Makes the plans, usually shared with the other slots, so every size is planned once.
+	TaskUpscale(const TaskUpscaleDesc& desc, Planner planner);
+
+	float progress() const override;
+
+	/// The planned task in progress, like "FSRCNN x3 5-1-3-1-9 128-16-48-128 (stage 1/2)".
+	QString status() const override;
+
+	void set_cancel_requested(bool requested) override;
+
+	PlanarImage do_task(PlanarImage&& input, std::function<void()> canceled) override;
+
+	const TaskDesc* get_desc() const override;
+
+private:
+	/// Planned chain of an input size.
+	struct Chain {
+		UpscalePlanner::Plan plan;
+		std::vector<std::unique_ptr<Task>> tasks;
+	};
+
+	Planner planner;
+	/// Chains by the input width, height and channels.
+	std::map<std::tuple<int, int, int>, Chain> chains;
+	/// Chain of the current image, nullptr before the first one.
+	std::atomic<Chain*> cur_chain = nullptr;
+	std::atomic<int> cur_task = 0;
+
+	/// The chain of the input, planned on the first use.
+	Chain& chain(const PlanarImage& input);
+};
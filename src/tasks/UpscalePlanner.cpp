@@ -0,0 +1,213 @@
+/*
+ * ImageUpscalerQt - upscale planner
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include <QFile>
+#include <QStringList>
+
+#include "UpscalePlanner.hpp"
+#include "../functions/func.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
+
+/// Most FSRCNN networks in a planned chain.
+constexpr int MAX_NETWORK_STAGES = 3;
+/// Largest enlargement of the resize that an SRCNN after it restores (the networks are trained up to x4).
+constexpr double MAX_SRCNN_SCALE = 4.0;
+/// Smallest scale of the resize after the networks, a bit below 2/3, so x3 still serves x2. The networks that
+/// enlarge much more than needed waste theirs work on the pixels that the resize drops, but the narrow x5 ones
+/// are cheap enough to win by the cost alone (x5 and x0.4 for x2). It also drops the networks after which
+/// the target is already reached.
+constexpr double MIN_SCALE_AFTER_NETWORKS = 0.65;
+/// Size on which the networks of the same multiplier are compared, theirs costs are proportional to the pixels.
+const QSize REFERENCE_SIZE(64, 64);
+
+struct QualityFloor {
+	/// Largest enlargement left to the interpolation.
+	double max_interpolated_scale;
+	/// Fewest feature channels (of the first layer) of the networks.
+	unsigned short min_features;
+	std::vector<Interpolation> interpolations;
+};
+
+/// Floors of the qualities in the order of UpscaleQuality.
+const QualityFloor QUALITY_FLOORS[3] = {
+	{2.0, 0, {Interpolation::bilinear, Interpolation::catmull_rom, Interpolation::lanczos3}},
+	{1.5, 32, {Interpolation::catmull_rom, Interpolation::lanczos3}},
+	{1.2, 128, {Interpolation::lanczos3}}
+};
+
+/// Architectures of the installed models of the kind.
+/// @param parse FSRCNNDesc::from_string() or SRCNNDesc::from_string().
+template<typename Desc>
+std::vector<Desc> installed_networks(const QString& kind, bool (*parse)(QString, Desc*)) {
+	std::vector<Desc> result;
+	for (const QString& file_name : ModelStore::instance().model_names(kind)) {
+		if (!file_name.endsWith(".bin") && !file_name.endsWith(".ium"))
+			continue;
+
+		Desc desc;
+		if (parse(file_name.section('.', -2, -2), &desc))
+			result.push_back(desc);
+	}
+
+	// A network may have both the raw parameters and the model container.
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+/// Whether the network can run in the precision: int8 needs a quantized model.
+bool has_precision(const QString& kind, const QString& desc, Precision precision) {
+	return precision != Precision::int8 || QFile::exists(NetworkCache::quantized_model_path(kind, desc));
+}
+
+UpscalePlanner::UpscalePlanner(int channels) : channels(channels) {
+	fsrcnns = installed_networks<FSRCNNDesc>("fsrcnn", FSRCNNDesc::from_string);
+	srcnns = installed_networks<SRCNNDesc>("srcnn", SRCNNDesc::from_string);
+}
+
+UpscalePlanner::Plan UpscalePlanner::plan(const TaskUpscaleDesc& desc, QSize input_size) const {
+	const QualityFloor& floor = QUALITY_FLOORS[static_cast<unsigned char>(desc.quality)];
+	const QSize target = desc.img_size_after(input_size);
+
+	// The cheapest FSRCNN of every multiplier and the cheapest SRCNN that meet the floor. The cost of a network
+	// is proportional to the pixels, so a chain never gets cheaper with another network of the same multiplier.
+	std::map<unsigned char, FSRCNNDesc> stages;
+	for (const FSRCNNDesc& fsrcnn : fsrcnns) {
+		if (fsrcnn.size_multiplier < 2 || fsrcnn.channels[1] < floor.min_features ||
+			!has_precision("fsrcnn", fsrcnn.to_string(), desc.precision))
+			continue;
+
+		auto cur = stages.find(fsrcnn.size_multiplier);
+		if (cur == stages.end() || func::fsrcnn_operations_amount(fsrcnn, REFERENCE_SIZE) <
+								   func::fsrcnn_operations_amount(cur->second, REFERENCE_SIZE))
+			stages[fsrcnn.size_multiplier] = fsrcnn;
+	}
+
+	const SRCNNDesc* srcnn = nullptr;
+	for (const SRCNNDesc& cur : srcnns) {
+		if (cur.channels[1] < floor.min_features || !has_precision("srcnn", cur.to_string(), desc.precision))
+			continue;
+		if (srcnn == nullptr || func::srcnn_operations_amount(cur, REFERENCE_SIZE) <
+								func::srcnn_operations_amount(*srcnn, REFERENCE_SIZE))
+			srcnn = &cur;
+	}
+
+	// Every sequence of the networks, from none to MAX_NETWORK_STAGES of them.
+	std::vector<std::vector<FSRCNNDesc>> sequences = {{}};
+	for (size_t i = 0; i < sequences.size(); i++) {
+		if (sequences[i].size() == MAX_NETWORK_STAGES)
+			continue;
+		for (const auto& [multiplier, fsrcnn] : stages) {
+			auto sequence = sequences[i];
+			sequence.push_back(fsrcnn);
+			sequences.push_back(sequence);
+		}
+	}
+
+	Plan best;
+	bool found = false;
+	// The plan that leaves the least enlargement to the interpolation if none meets the floor.
+	Plan closest;
+	double closest_scale = std::numeric_limits<double>::max();
+
+	const auto consider = [&](const std::vector<std::shared_ptr<TaskDesc>>& tasks, double interpolated_scale) {
+		const unsigned long long cur_operations = operations(tasks, input_size);
+		if (interpolated_scale <= floor.max_interpolated_scale) {
+			if (!found || cur_operations < best.operations) {
+				best = {tasks, cur_operations, true};
+				found = true;
+			}
+		}
+		else if (interpolated_scale < closest_scale ||
+				 (interpolated_scale == closest_scale && cur_operations < closest.operations)) {
+			closest = {tasks, cur_operations, false};
+			closest_scale = interpolated_scale;
+		}
+	};
+
+	for (const auto& sequence : sequences) {
+		std::vector<std::shared_ptr<TaskDesc>> tasks;
+		QSize size = input_size;
+		int multiplier = 1;
+		for (const FSRCNNDesc& fsrcnn : sequence) {
+			tasks.push_back(std::make_shared<TaskFSRCNNDesc>(fsrcnn, desc.block_size, desc.luma_only, desc.precision));
+			size = tasks.back()->img_size_after(size);
+			multiplier *= fsrcnn.size_multiplier;
+		}
+
+		if (size == target) {
+			consider(tasks, 1.0);
+			continue;
+		}
+
+		// The rest is resized by the factor if the target is a factor, so every image keeps its aspect ratio.
+		const double x_scale = static_cast<double>(target.width()) / size.width();
+		const double y_scale = static_cast<double>(target.height()) / size.height();
+		if (!sequence.empty() && std::min(x_scale, y_scale) < MIN_SCALE_AFTER_NETWORKS)
+			continue;
+
+		const double resize_scale = std::max(x_scale, y_scale);
+		const auto with_resize = [&](Interpolation interpolation) {
+			auto result = tasks;
+			if (desc.scale != 0.0)
+				result.push_back(std::make_shared<TaskResizeDesc>(interpolation, desc.scale / multiplier));
+			else
+				result.push_back(std::make_shared<TaskResizeDesc>(interpolation, target));
+			return result;
+		};
+
+		for (Interpolation interpolation : floor.interpolations) {
+			// Bilinear doesn't filter, it skips pixels when reducing more than twice.
+			if (interpolation == Interpolation::bilinear && resize_scale < 0.5)
+				continue;
+			consider(with_resize(interpolation), std::max(resize_scale, 1.0));
+		}
+
+		// SRCNN restores the details of a bicubic enlargement, like it was trained.
+		if (srcnn != nullptr && resize_scale > 1.0 && resize_scale <= MAX_SRCNN_SCALE) {
+			auto restored = with_resize(Interpolation::catmull_rom);
+			restored.push_back(std::make_shared<TaskSRCNNDesc>(*srcnn, desc.block_size, desc.luma_only,
+															   desc.precision));
+			consider(restored, 1.0);
+		}
+	}
+
+	return found ? best : closest;
+}
+
+QString UpscalePlanner::plan_string(const TaskUpscaleDesc& desc, QSize input_size, const Plan& plan) {
+	QString result = QString("Planned \"%1\" for %2x%3").arg(desc.to_string(), QString::number(input_size.width()),
+															 QString::number(input_size.height()));
+	if (plan.tasks.empty())
+		return result + ": nothing to do";
+
+	QStringList tasks;
+	for (const auto& task : plan.tasks)
+		tasks.append(QString("\"%1\"").arg(task->to_string()));
+	result += QString(" as %1 (about %2 per image)").arg(tasks.join(", "),
+		func::operations_amount_to_string(plan.operations));
+
+	if (!plan.meets_quality) {
+		result += ". No chain meets the quality floor with the installed networks, "
+				  "this one leaves the least enlargement to the interpolation";
+	}
+	return result;
+}
+
+unsigned long long UpscalePlanner::operations(const std::vector<std::shared_ptr<TaskDesc>>& tasks,
+											  QSize size) const {
+	unsigned long long result = 0;
+	for (const auto& task : tasks) {
+		result += func::task_operations_amount(*task, size, channels);
+		size = task->img_size_after(size);
+	}
+	return result;
+}
@@ -0,0 +1,57 @@
+/*
+ * ImageUpscalerQt - upscale planner header
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QSize>
+#include <QString>
+
+#include "TaskDesc.hpp"
+
+/// Plans the upscale task (see TaskUpscaleDesc). Searches the chains of up to 3 installed FSRCNN networks
+/// followed by a resize to the target size. An enlarging resize may also be followed by an SRCNN that
+/// restores the details. The search picks the cheapest chain that meets the quality floor:
+/// - the resize without an SRCNN after it may enlarge at most x2 (low quality), x1.5 (medium) or x1.2 (high);
+/// - the networks have at least 0, 32 or 128 feature channels (the first layer);
+/// - the resize uses bilinear, Catmull-Rom or Lanczos3 (low), Catmull-Rom or Lanczos3 (medium),
+///   or only Lanczos3 (high).
+/// The cost is the APPROXIMATE amount of arithmetic operations (see func::task_operations_amount()).
+/// The resize after the networks reduces at most to about x2/3: the narrow x5 networks are cheaper than
+/// the x3 ones, but upscaling x5 only to reduce the result heavily wastes most of theirs work.
+class UpscalePlanner {
+public:
+	struct Plan {
+		std::vector<std::shared_ptr<TaskDesc>> tasks;
+		/// APPROXIMATE arithmetic operations of the tasks on the image of the planned size.
+		unsigned long long operations = 0;
+		/// False if no chain meets the quality floor with the installed networks.
+		/// The plan leaves the least enlargement to the interpolation then.
+		bool meets_quality = true;
+	};
+
+	/// Find the installed networks.
+	/// @param channels Channels of the images, the luma-only networks process one of them.
+	explicit UpscalePlanner(int channels = 3);
+
+	/// Plan the task for an image of the size. If the target is a factor, the planned resize is also
+	/// by a factor, so the images of other sizes are upscaled by the same factor.
+	Plan plan(const TaskUpscaleDesc& desc, QSize input_size) const;
+
+	/// Description of the plan for the user, like "Planned "Upscale x4, medium quality" for 640x480 as
+	/// "Use FSRCNN x3 5-1-3-1-9 128-16-48-128", "Resize x1.333 | Lanczos3" (about 12.34 GFLOP per image)".
+	static QString plan_string(const TaskUpscaleDesc& desc, QSize input_size, const Plan& plan);
+
+private:
+	int channels;
+	std::vector<FSRCNNDesc> fsrcnns;
+	std::vector<SRCNNDesc> srcnns;
+
+	/// Operations of the tasks one after another on the image of the size.
+	unsigned long long operations(const std::vector<std::shared_ptr<TaskDesc>>& tasks, QSize size) const;
+};
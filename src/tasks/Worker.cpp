@@ -4,11 +4,101 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <OpenImageIO/imageio.h>
+
 #include "Worker.hpp"
 #include "TaskResize.hpp"
 #include "TaskConvertColorSpace.hpp"
 #include "TaskSRCNN.hpp"
 #include "TaskFSRCNN.hpp"
+#include "TaskUpscale.hpp"
+#include "TaskChainOptimizer.hpp"
+#include "../functions/func.hpp"
+
+/// Amount of pixels in a neural network block that keeps one core busy.
+/// oneDNN's intra-op threading doesn't scale on smaller blocks.
+constexpr unsigned long long CNN_PIXELS_PER_CORE = 128ull * 128ull / 2ull;
+/// Amount of pixels that keeps one core busy in the other tasks.
+constexpr unsigned long long PIXELS_PER_CORE = 512ull * 512ull;
+/// Amount of first images whose headers stand for all images: theirs sizes choose the amount of concurrent
+/// images and are planned in advance, theirs channels allow the color space rewrites of the chain.
+constexpr int SAMPLED_IMAGES = 8;
+/// Tile size of the streamed images written in the formats that support tiles (TIFF, OpenEXR).
+constexpr int STREAM_TILE_SIZE = 64;
+/// Part of the free memory that the images in flight may take if the memory budget is not set.
+constexpr double AUTO_MEMORY_BUDGET_SHARE = 0.75;
+
+/// Channels of the image that go through the neural network of the task.
+/// @returns 0 if the task has no neural network.
+int network_channels(const TaskDesc& desc, int channels) {
+	bool luma_only;
+	if (desc.task_kind() == TaskKind::srcnn)
+		luma_only = static_cast<const TaskSRCNNDesc&>(desc).luma_only;
+	else if (desc.task_kind() == TaskKind::fsrcnn)
+		luma_only = static_cast<const TaskFSRCNNDesc&>(desc).luma_only;
+	else
+		return 0;
+
+	return luma_only && channels >= 3 ? 1 : channels;
+}
+
+/// Blocks of the neural network of the task on the image. The task must have a neural network.
+func::CNNBlocks network_blocks(const TaskDesc& desc, QSize size, int channels, unsigned long long memory_limit) {
+	if (desc.task_kind() == TaskKind::srcnn) {
+		const auto& cnn_desc = static_cast<const TaskSRCNNDesc&>(desc);
+		return func::cnn_blocks(cnn_desc.srcnn_desc, size, cnn_desc.block_size,
+								network_channels(desc, channels), memory_limit);
+	}
+
+	const auto& cnn_desc = static_cast<const TaskFSRCNNDesc&>(desc);
+	return func::cnn_blocks(cnn_desc.fsrcnn_desc, size, cnn_desc.block_size,
+							network_channels(desc, channels), memory_limit);
+}
+
+/// Read the rows [ybegin, yend) of the image as float pixels.
+/// Tiled images are read by whole rows of tiles.
+/// @returns false on errors.
+bool read_rows(OIIO::ImageInput& input, int ybegin, int yend, float* pixels) {
+	const auto& spec = input.spec();
+	if (spec.tile_width == 0) {
+		return input.read_scanlines(0, 0, spec.y + ybegin, spec.y + yend, spec.z, 0, spec.nchannels,
+									OIIO::TypeDesc::FLOAT, pixels);
+	}
+
+	const int tiles_begin = ybegin / spec.tile_height * spec.tile_height;
+	const int tiles_end = std::min((yend + spec.tile_height - 1) / spec.tile_height * spec.tile_height, spec.height);
+	const size_t row_size = static_cast<size_t>(spec.width) * spec.nchannels;
+	std::vector<float> tiles(row_size * (tiles_end - tiles_begin));
+	if (!input.read_tiles(0, 0, spec.x, spec.x + spec.width, spec.y + tiles_begin, spec.y + tiles_end,
+						  spec.z, spec.z + std::max(spec.depth, 1), 0, spec.nchannels,
+						  OIIO::TypeDesc::FLOAT, tiles.data()))
+		return false;
+
+	std::copy(tiles.begin() + (ybegin - tiles_begin) * row_size, tiles.begin() + (yend - tiles_begin) * row_size,
+			  pixels);
+	return true;
+}
+
+/// Input rows of every strip of the streamed image. Tiled outputs get whole rows of tiles,
+/// so the rows are rounded up to the tile height there; the other outputs are written by scanlines.
+int stream_strip_rows(int strip_height, int height, bool tiled_output) {
+	const int rows = std::min(strip_height, height);
+	if (!tiled_output)
+		return rows;
+	return (rows + STREAM_TILE_SIZE - 1) / STREAM_TILE_SIZE * STREAM_TILE_SIZE;
+}
 
 Worker::Worker() {
 
@@ -21,46 +111,326 @@ Worker::Worker(const std::vector<std::shared_ptr<TaskDesc>>& tasks,
 
 void Worker::init(std::vector<std::shared_ptr<TaskDesc>> task_descs,
 				  std::vector<std::pair<QString, QString>> files) {
-	// Construct tasks from theirs descriptions.
-	tasks.resize(task_descs.size());
-	for (int i = 0; i < task_descs.size(); i++) {
-		const auto ptr = task_descs[i];
+	this->files = files;
+	this->task_descs = task_descs;
+	chain_rewrites.clear();
 
-		switch (ptr->task_kind()) {
-		case TaskKind::resize: {
-			tasks[i] = new TaskResize(*dynamic_cast<TaskResizeDesc*>(ptr.get()));
-			break;
+	// The first image is a sample for the estimates of the saved work. The color space rewrites
+	// need the channels of every image, the first images stand for the others.
+	QSize sample_size;
+	int channels = 0;
+	for (int i = 0; i < std::min<int>(files.size(), SAMPLED_IMAGES); i++) {
+		auto img_input = OIIO::ImageInput::open(files[i].first.toStdString());
+		if (!img_input)
+			continue;
+
+		if (sample_size.isEmpty())
+			sample_size = QSize(img_input->spec().width, img_input->spec().height);
+		channels = channels == 0 ? img_input->spec().nchannels : std::min(channels, img_input->spec().nchannels);
+	}
+
+	if (chain_optimization) {
+		TaskChainOptimizer optimizer(sample_size, channels);
+		this->task_descs = optimizer.optimize(this->task_descs);
+		chain_rewrites += optimizer.get_log();
+		if (optimizer.get_color_rewritten() && files.size() > SAMPLED_IMAGES) {
+			chain_rewrites.append(QString("The color space rewrites assume that the images after the first %1 "
+				"have at least 3 channels too").arg(SAMPLED_IMAGES));
 		}
-		case TaskKind::convert_color_space: {
-			tasks[i] = new TaskConvertColorSpace(*dynamic_cast<TaskConvertColorSpaceDesc*>(ptr.get()));
-			break;
+	}
+
+	describe_upscale_plans();
+	create_slots(auto_concurrent_images());
+}
+
+void Worker::describe_upscale_plans() {
+	upscale_plans.clear();
+	// The installed networks may have changed since the last run.
+	upscale_planners.clear();
+	const bool has_upscale = std::any_of(task_descs.begin(), task_descs.end(), [](const auto& desc) {
+		return desc->task_kind() == TaskKind::upscale;
+	});
+	if (!has_upscale)
+		return;
+
+	// Every size of the first images once.
+	std::vector<std::tuple<int, int, int>> described;
+	for (int i = 0; i < std::min<int>(files.size(), SAMPLED_IMAGES); i++) {
+		auto img_input = OIIO::ImageInput::open(files[i].first.toStdString());
+		if (!img_input)
+			continue;
+
+		const auto& spec = img_input->spec();
+		const auto key = std::make_tuple(spec.width, spec.height, spec.nchannels);
+		if (std::find(described.begin(), described.end(), key) != described.end())
+			continue;
+		described.push_back(key);
+
+		// The plans are made for the image size before every upscale task.
+		QSize size(spec.width, spec.height);
+		for (const auto& desc : task_descs) {
+			if (desc->task_kind() == TaskKind::upscale) {
+				chain_rewrites.append(UpscalePlanner::plan_string(static_cast<const TaskUpscaleDesc&>(*desc), size,
+					upscale_plan(*desc, size, spec.nchannels)));
+			}
+			size = desc->img_size_after(size);
 		}
-		case TaskKind::srcnn: {
-			tasks[i] = new TaskSRCNN(*dynamic_cast<TaskSRCNNDesc*>(ptr.get()));
-			break;
+	}
+
+	if (files.size() > SAMPLED_IMAGES) {
+		chain_rewrites.append(QString("The images after the first %1 are planned for theirs sizes when they are read")
+			.arg(SAMPLED_IMAGES));
+	}
+}
+
+std::vector<std::shared_ptr<TaskDesc>> Worker::planned_chain(QSize size, int channels) const {
+	std::vector<std::shared_ptr<TaskDesc>> result;
+	for (const auto& desc : task_descs) {
+		if (desc->task_kind() == TaskKind::upscale) {
+			const UpscalePlanner::Plan plan = upscale_plan(*desc, size, channels);
+			result.insert(result.end(), plan.tasks.begin(), plan.tasks.end());
 		}
-		case TaskKind::fsrcnn: {
-			tasks[i] = new TaskFSRCNN(*dynamic_cast<TaskFSRCNNDesc*>(ptr.get()));
-			break;
+		else {
+			result.push_back(desc);
 		}
+
+		size = desc->img_size_after(size);
+	}
+
+	return result;
+}
+
+UpscalePlanner::Plan Worker::upscale_plan(const TaskDesc& desc, QSize size, int channels) const {
+	std::lock_guard<std::mutex> lock(upscale_plans_mutex);
+	const auto key = std::make_tuple(&desc, size.width(), size.height(), channels);
+	auto plan = upscale_plans.find(key);
+	if (plan == upscale_plans.end()) {
+		// The planner finds the installed networks once.
+		auto planner = upscale_planners.find(channels);
+		if (planner == upscale_planners.end())
+			planner = upscale_planners.emplace(channels, UpscalePlanner(channels)).first;
+		plan = upscale_plans.emplace(key, planner->second.plan(static_cast<const TaskUpscaleDesc&>(desc), size)).first;
+	}
+	return plan->second;
+}
+
+void Worker::create_slots(int amount) {
+	slots.clear();
+
+	for (int s = 0; s < amount; s++) {
+		auto slot = std::make_unique<Slot>();
+
+		// Construct tasks from theirs descriptions.
+		slot->tasks.resize(task_descs.size());
+		for (int i = 0; i < task_descs.size(); i++) {
+			const auto ptr = task_descs[i];
+
+			switch (ptr->task_kind()) {
+			case TaskKind::resize: {
+				slot->tasks[i] = new TaskResize(*dynamic_cast<TaskResizeDesc*>(ptr.get()));
+				break;
+			}
+			case TaskKind::convert_color_space: {
+				slot->tasks[i] = new TaskConvertColorSpace(*dynamic_cast<TaskConvertColorSpaceDesc*>(ptr.get()));
+				break;
+			}
+			case TaskKind::srcnn: {
+				slot->tasks[i] = new TaskSRCNN(*dynamic_cast<TaskSRCNNDesc*>(ptr.get()));
+				break;
+			}
+			case TaskKind::fsrcnn: {
+				slot->tasks[i] = new TaskFSRCNN(*dynamic_cast<TaskFSRCNNDesc*>(ptr.get()));
+				break;
+			}
+			case TaskKind::upscale: {
+				// The slots share the plans of the worker.
+				const TaskDesc* desc = ptr.get();
+				slot->tasks[i] = new TaskUpscale(*dynamic_cast<TaskUpscaleDesc*>(ptr.get()),
+					[this, desc](QSize size, int channels) { return upscale_plan(*desc, size, channels); });
+				break;
+			}
+			}
 		}
+
+		slots.push_back(std::move(slot));
 	}
+}
 
-	this->files = files;
+void Worker::set_concurrent_images(int amount) {
+	create_slots(amount > 0 ? amount : auto_concurrent_images());
+}
+
+int Worker::get_concurrent_images() const {
+	return slots.size();
+}
+
+void Worker::set_strip_height(int rows) {
+	strip_height = std::max(rows, 0);
+}
+
+void Worker::set_memory_budget(unsigned long long bytes) {
+	memory_budget = bytes;
+}
+
+void Worker::set_chain_optimization(bool enabled) {
+	chain_optimization = enabled;
+}
+
+QStringList Worker::get_chain_rewrites() const {
+	return chain_rewrites;
+}
+
+bool Worker::can_stream() const {
+	return std::all_of(task_descs.begin(), task_descs.end(), [](const auto& desc) {
+		return desc->strip_halo() >= 0;
+	});
+}
+
+int Worker::auto_concurrent_images() const {
+	// How many cores and how much memory the heaviest task needs.
+	int cores_per_image = 1;
+	unsigned long long mem_per_image = 0;
+
+	for (int i = 0; i < std::min<int>(files.size(), SAMPLED_IMAGES); i++) {
+		auto img_input = OIIO::ImageInput::open(files[i].first.toStdString());
+		if (!img_input)
+			continue;
+
+		const auto& spec = img_input->spec();
+		QSize cur_size(spec.width, spec.height);
+
+		mem_per_image = std::max(mem_per_image, image_memory_demand(cur_size, spec.nchannels));
+
+		for (const auto& desc : planned_chain(cur_size, spec.nchannels)) {
+			const QSize next_size = desc->img_size_after(cur_size);
+			unsigned long long cur_pixels = static_cast<unsigned long long>(next_size.width()) * next_size.height();
+			unsigned long long pixels_per_core = PIXELS_PER_CORE;
+
+			// Neural networks process all channels of a single block at a time.
+			const int cnn_channels = network_channels(*desc, spec.nchannels);
+			if (cnn_channels != 0) {
+				const QSize window = network_blocks(*desc, cur_size, spec.nchannels, 0).window;
+				cur_pixels = static_cast<unsigned long long>(window.width()) * window.height() * cnn_channels;
+				pixels_per_core = CNN_PIXELS_PER_CORE;
+			}
+
+			cores_per_image = std::max<int>(cores_per_image, (cur_pixels + pixels_per_core - 1) / pixels_per_core);
+			cur_size = next_size;
+		}
+	}
+
+	const int threads = func::hardware_threads();
+	int amount = threads / std::min(cores_per_image, threads);
+
+	// Leave a half of the free memory for the queues and everything else.
+	const auto free_memory = func::free_physical_memory();
+	if (mem_per_image != 0 && free_memory) {
+		const unsigned long long mem_amount = *free_memory / 2ull / mem_per_image;
+		amount = std::min<unsigned long long>(amount, mem_amount);
+	}
+
+	amount = std::min<int>(amount, files.size());
+	return std::max(amount, 1);
+}
+
+unsigned long long Worker::image_memory_demand(QSize size, int channels, unsigned long long network_limit,
+											   bool with_networks) const {
+	// The decoded buffer and the planar image while the image is read.
+	unsigned long long result = static_cast<unsigned long long>(size.width()) * size.height() * channels *
+		sizeof(float) * 2ull;
+
+	for (const auto& desc : planned_chain(size, channels)) {
+		const QSize next_size = desc->img_size_after(size);
+		const unsigned long long pixels = static_cast<unsigned long long>(size.width()) * size.height();
+		const unsigned long long next_pixels = static_cast<unsigned long long>(next_size.width()) * next_size.height();
+
+		// Input and output of the task. The color space conversion works in place.
+		unsigned long long cur_mem = (desc->task_kind() == TaskKind::convert_color_space ?
+			std::max(pixels, next_pixels) : pixels + next_pixels) * channels * sizeof(float);
+
+		if (with_networks && network_channels(*desc, channels) != 0)
+			cur_mem += network_blocks(*desc, size, channels, network_limit).memory;
+
+		result = std::max(result, cur_mem);
+		size = next_size;
+	}
+
+	// The planar image and the interleaved buffer while the result is written.
+	return std::max(result, static_cast<unsigned long long>(size.width()) * size.height() * channels *
+					sizeof(float) * 2ull);
+}
+
+bool Worker::admit_image(QSize size, int channels, PipelineImage& image) {
+	const unsigned long long budget = memory_governor.get_budget();
+	image.network_memory_limit = 0;
+	unsigned long long demand = image_memory_demand(size, channels);
+
+	// Reduce the blocks of the neural networks, so the image fits in the budget at least alone.
+	if (demand > budget) {
+		const unsigned long long buffers = image_memory_demand(size, channels, 0, false);
+		image.network_memory_limit = budget > buffers ? budget - buffers : 1ull;
+		demand = image_memory_demand(size, channels, image.network_memory_limit);
+	}
+
+	if (!memory_governor.acquire(demand))
+		return false;
+	image.reserved_memory = demand;
+	return true;
+}
+
+void Worker::chain_scale_and_halo(int& scale, int& halo) const {
+	// The halo of every task is in the rows of its input, which is already scaled by the previous tasks.
+	scale = 1;
+	halo = 0;
+	for (const auto& desc : task_descs) {
+		halo += (desc->strip_halo() + scale - 1) / scale;
+		scale *= desc->img_size_after(QSize(1, 1)).height();
+	}
+}
+
+const Worker::Slot& Worker::status_slot() const {
+	const Slot* result = slots[0].get();
+	int min_img = INT_MAX;
+
+	for (const auto& slot : slots) {
+		const int img = slot->cur_img;
+		if (img >= 0 && img < min_img) {
+			min_img = img;
+			result = slot.get();
+		}
+	}
+
+	return *result;
 }
 
 float Worker::cur_task_progress() const {
-	return tasks[get_cur_task_index()]->progress() * 0.99f + img_writing_progress * 0.01f;
+	const Slot& slot = status_slot();
+	// The optimization may leave nothing to do.
+	if (slot.tasks.empty())
+		return img_writing_progress * 0.01f;
+	const int task_idx = std::clamp<int>(slot.cur_task, 0, slot.tasks.size() - 1);
+	return slot.tasks[task_idx]->progress() * 0.99f + img_writing_progress * 0.01f;
 }
 
 float Worker::overall_progress() const {
-	const float& task_idx = static_cast<float>(get_cur_task_index());
-	const float& cur_task_prog = cur_task_progress();
-	const float& tasks_n = static_cast<float>(tasks.size());
-	const float& cur_img = static_cast<float>(get_cur_img_index());
+	const float& tasks_n = static_cast<float>(task_descs.size());
+	float images_done = static_cast<float>(images_processed);
+
+	// Add the progress of the images in flight.
+	for (const auto& slot : slots) {
+		if (slot->cur_img < 0 || slot->tasks.empty())
+			continue;
+
+		const int task_idx = std::clamp<int>(slot->cur_task, 0, slot->tasks.size() - 1);
+		float image_progress = (task_idx + slot->tasks[task_idx]->progress()) / tasks_n;
+		// The tasks run on every strip of a streamed image.
+		const int strips = slot->strips_amount;
+		if (strips != 0)
+			image_progress = (slot->cur_strip + image_progress) / strips;
+		images_done += image_progress;
+	}
 
-	float cur_img_progress = (task_idx + cur_task_prog) / tasks_n;
-	return (cur_img + cur_img_progress) / files.size();
+	return std::min(images_done / files.size(), 1.0f);
 }
 
 QString Worker::cur_status() const {
@@ -68,122 +438,582 @@ QString Worker::cur_status() const {
 	// other thread can change these values during execution of this function.
 	auto cur_task_copy = get_cur_task_index();
 	auto cur_img_copy = get_cur_img_index();
+	const auto& cur_tasks = status_slot().tasks;
 
 	if (everything_finished) {
 		return "Done!";
 	}
 
 	if (img_writing_now) {
-		return QString("Image %1/%2, saving...").arg(
-			QString::number(cur_img_copy + 1),
+		return QString("Saving images, %1/%2 written...").arg(
+			QString::number(images_written.load()),
 			QString::number(files.size())
 		);
 	}
 
+	// "Image 1/10" or "Image 1/10 (+3 in progress)" if several images are processed at once.
+	int images_in_flight = 0;
+	for (const auto& slot : slots)
+		images_in_flight += slot->cur_img >= 0;
+
+	QString image_str = QString("Image %1/%2").arg(
+		QString::number(cur_img_copy + 1),
+		QString::number(files.size())
+	);
+	if (images_in_flight > 1)
+		image_str += QString(" (+%1 in progress)").arg(QString::number(images_in_flight - 1));
+	const int strips = status_slot().strips_amount;
+	if (strips != 0)
+		image_str += QString(", strip %1/%2").arg(QString::number(status_slot().cur_strip + 1), QString::number(strips));
+
 	// Prepare text for current task label.
+	// "SRCNN 9-5-5 64-32, block 96x96 (chosen automatically)" if the task has a status.
+	if (cur_tasks.empty())
+		return image_str;
+
+	QString task_str = cur_tasks[cur_task_copy]->get_desc()->to_string();
+	const QString task_status = cur_tasks[cur_task_copy]->status();
+	if (!task_status.isEmpty())
+		task_str += ", " + task_status;
+
 	// Task 1/1: Unknown task.
 	if (cur_task_progress() == 0)
-		return QString("Image %1/%2, task %3/%4: %5").arg(
-			QString::number(cur_img_copy + 1),
-			QString::number(files.size()),
+		return QString("%1, task %2/%3: %4").arg(
+			image_str,
 			QString::number(cur_task_copy + 1),
-			QString::number(tasks.size()),
-			tasks[cur_task_copy]->get_desc()->to_string());
+			QString::number(cur_tasks.size()),
+			task_str);
 	// Task 1/1: Unknown task (100%).
 	else
-		return QString("Image %1/%2, task %3/%4: %5 (%6%)").arg(
-			QString::number(cur_img_copy + 1),
-			QString::number(files.size()),
+		return QString("%1, task %2/%3: %4 (%5%)").arg(
+			image_str,
 			QString::number(cur_task_copy + 1),
-			QString::number(tasks.size()),
-			tasks[cur_task_copy]->get_desc()->to_string(),
+			QString::number(cur_tasks.size()),
+			task_str,
 			QString::number(static_cast<int>(cur_task_progress() * 100.0f)));
 }
 
 int Worker::get_cur_task_index() const {
-	if (cur_task >= tasks.size())
-		return tasks.size() - 1;
-	return cur_task;
+	const Slot& slot = status_slot();
+	return std::clamp<int>(slot.cur_task, 0, std::max<int>(slot.tasks.size() - 1, 0));
 }
 
 int Worker::get_cur_img_index() const {
+	const int cur_img = status_slot().cur_img;
+	if (cur_img < 0)
+		return std::min<int>(images_processed, files.size() - 1);
 	if (cur_img >= files.size())
 		return files.size() - 1;
 	return cur_img;
 }
 
-void Worker::do_tasks(std::function<void()> success, std::function<void()> canceled,
-					  std::function<void(QString)> error) {
-	// Disable "cancel_requested" in all tasks.
-	for (int i = 0; i < tasks.size(); i++)
-		tasks[i]->cancel_requested = false;
+void Worker::set_queue_depth(int depth) {
+	queue_depth = std::max(depth, 1);
+}
+
+void Worker::set_pipeline_error(const QString& message) {
+	std::lock_guard<std::mutex> lock(pipeline_error_mutex);
+	// Keep only the first error, the next ones are usually its consequences.
+	if (!pipeline_failed) {
+		pipeline_error = message;
+		pipeline_failed = true;
+	}
+
+	// Images that wait for the memory would never get it.
+	memory_governor.close();
+}
+
+void Worker::record_timings(int index, const std::function<void(ImageTimings&)>& record) {
+	std::lock_guard<std::mutex> lock(timings_mutex);
+	record(timings[index]);
+	record(total_timings);
+}
+
+void Worker::record_task_timings(const Slot& slot, int index, int task, double task_ms) {
+	const double construction_ms = slot.tasks[task]->network_construction_ms;
+	const double execution_ms = slot.tasks[task]->network_execution_ms;
+	record_timings(index, [&](ImageTimings& t) {
+		t.task_ms[task] += task_ms;
+		t.network_construction_ms[task] += construction_ms;
+		t.network_execution_ms[task] += execution_ms;
+	});
+}
+
+/// Whether the task runs a neural network, so its network times are meaningful.
+bool has_network(const TaskDesc& desc) {
+	return desc.task_kind() == TaskKind::srcnn || desc.task_kind() == TaskKind::fsrcnn;
+}
+
+QString Worker::timings_summary() const {
+	std::lock_guard<std::mutex> lock(timings_mutex);
+
+	double sum = total_timings.decode_ms + total_timings.encode_ms;
+	for (double ms : total_timings.task_ms)
+		sum += ms;
+	if (sum <= 0.0)
+		return QString();
+
+	const auto percent = [sum](double ms) {
+		return QString::number(static_cast<int>(ms / sum * 100.0 + 0.5)) + '%';
+	};
+
+	QStringList parts;
+	parts.push_back("Decode " + percent(total_timings.decode_ms));
+	for (int i = 0; i < task_descs.size(); i++) {
+		QString part = task_descs[i]->to_string() + ' ' + percent(total_timings.task_ms[i]);
+		if (has_network(*task_descs[i])) {
+			part += QString(" (networks: build %1, execute %2)").arg(
+				percent(total_timings.network_construction_ms[i]),
+				percent(total_timings.network_execution_ms[i]));
+		}
+		parts.push_back(part);
+	}
+	parts.push_back("encode " + percent(total_timings.encode_ms));
+
+	return parts.join(", ");
+}
 
-#ifdef NDEBUG
+bool Worker::write_report(const QString& path) const {
+	std::lock_guard<std::mutex> lock(timings_mutex);
+
+	const auto timings_json = [this](const ImageTimings& t) {
+		QJsonArray tasks;
+		for (int i = 0; i < task_descs.size(); i++) {
+			QJsonObject task{
+				{"task", task_descs[i]->to_string()},
+				{"ms", t.task_ms[i]}
+			};
+			if (has_network(*task_descs[i])) {
+				task["network_construction_ms"] = t.network_construction_ms[i];
+				task["network_execution_ms"] = t.network_execution_ms[i];
+			}
+			tasks.append(task);
+		}
+
+		return QJsonObject{
+			{"decode_ms", t.decode_ms},
+			{"tasks", tasks},
+			{"encode_ms", t.encode_ms}
+		};
+	};
+
+	QJsonArray rewrites;
+	for (const QString& rewrite : chain_rewrites)
+		rewrites.append(rewrite);
+
+	QJsonArray images;
+	for (int i = 0; i < timings.size(); i++) {
+		QJsonObject image = timings_json(timings[i]);
+		image["input"] = files[i].first;
+		image["output"] = files[i].second;
+		images.append(image);
+	}
+
+	const QJsonObject report{
+		{"images_amount", static_cast<int>(files.size())},
+		{"images_written", images_written.load()},
+		{"concurrent_images", static_cast<int>(slots.size())},
+		{"strip_height", strip_height},
+		{"chain_rewrites", rewrites},
+		{"wall_ms", run_ms},
+		{"totals", timings_json(total_timings)},
+		{"images", images}
+	};
+
+	QFile file(path);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		return false;
+	return file.write(QJsonDocument(report).toJson()) != -1;
+}
+
+void Worker::read_images(BoundedQueue<PipelineImage>& decoded) {
 	try {
-#endif
-		for (cur_img = 0; cur_img < files.size(); cur_img++) {
-			// Read image.
-			auto cur_img_buf = OIIO::ImageBuf(files[cur_img].first.toStdString());
-			if (cur_img_buf.has_error()) {
-				error(QString::fromStdString(
+		for (int i = 0; i < files.size(); i++) {
+			if (cancel_requested || pipeline_failed)
+				break;
+
+			PipelineImage image;
+			image.index = i;
+
+			// Streamed images are read by the tasks stage, only a strip of them is in memory.
+			if (strip_height != 0) {
+				// If the image can't be opened, the tasks stage reports it.
+				if (auto input = OIIO::ImageInput::open(files[i].first.toStdString())) {
+					int scale, halo;
+					chain_scale_and_halo(scale, halo);
+					const OIIO::ImageSpec& spec = input->spec();
+					const auto output = OIIO::ImageOutput::create(files[i].second.toStdString());
+					const bool tiled = output && output->supports("tiles");
+					const int strip_rows = std::min(stream_strip_rows(strip_height, spec.height, tiled) + halo * 2,
+													spec.height);
+					if (!admit_image(QSize(spec.width, strip_rows), spec.nchannels, image))
+						break;
+				}
+
+				if (!decoded.push(std::move(image)))
+					break;
+				continue;
+			}
+
+			// The header is enough to know the memory demand of the image.
+			OIIO::ImageBuf buf(files[i].first.toStdString());
+			const OIIO::ImageSpec& spec = buf.spec();
+			if (!buf.has_error() && !admit_image(QSize(spec.width, spec.height), spec.nchannels, image))
+				break;
+
+			const auto decode_start = std::chrono::steady_clock::now();
+			// Force reading right now (ImageBuf reads lazily otherwise),
+			// so the decoding happens in this thread. Keep the original pixel format.
+			if (!buf.has_error())
+				buf.read(0, 0, true, OIIO::TypeUnknown);
+			if (buf.has_error()) {
+				set_pipeline_error(QString::fromStdString(
 					"Can't read the image. The file may be inaccessible, "
 					"in an unsupported format or damaged.\nMessage:\n"
-					+ cur_img_buf.geterror()
+					+ buf.geterror()
 				));
-				return;
+				break;
+			}
+			// The tasks get planar float pixels, the decoded buffer is freed right away.
+			image.spec = spec;
+			image.pixels = PlanarImage::from_image_buf(buf);
+			buf.clear();
+			const double decode_ms = func::elapsed_ms(decode_start);
+			record_timings(i, [&](ImageTimings& t) { t.decode_ms += decode_ms; });
+
+			if (!decoded.push(std::move(image)))
+				break; // The pipeline is stopped.
+		}
+	}
+	catch (const std::exception& e) {
+		set_pipeline_error(e.what());
+	}
+	catch (...) {
+		set_pipeline_error("Unknown error");
+	}
+
+	decoded.close();
+}
+
+bool Worker::process_images(Slot& slot, BoundedQueue<PipelineImage>& decoded,
+							BoundedQueue<PipelineImage>& processed, std::function<void()> canceled) {
+	PipelineImage image;
+	while (decoded.pop(image)) {
+		if (pipeline_failed)
+			break;
+
+		slot.cur_task = 0;
+		slot.cur_img = image.index;
+		for (Task* task : slot.tasks)
+			task->network_memory_limit = image.network_memory_limit;
+
+		if (strip_height != 0) {
+			const bool streamed = stream_image(slot, image.index, canceled);
+			memory_governor.release(image.reserved_memory);
+			if (!streamed)
+				return false;
+
+			images_processed++;
+			images_written++;
+			slot.cur_img = -1;
+			continue;
+		}
+
+		for (int i = 0; i < slot.tasks.size(); i++) {
+			slot.cur_task = i;
+			// The image is handed over to the task without copying.
+			const auto task_start = std::chrono::steady_clock::now();
+			image.pixels = slot.tasks[i]->do_task(std::move(image.pixels), canceled);
+			record_task_timings(slot, image.index, i, func::elapsed_ms(task_start));
+
+			if (cancel_requested)
+				return false;
+		}
+
+		images_processed++;
+		slot.cur_img = -1;
+
+		if (!processed.push(std::move(image)))
+			break; // The encode stage failed.
+	}
+
+	return true;
+}
+
+bool Worker::stream_image(Slot& slot, int index, std::function<void()> canceled) {
+	const std::string input_path = files[index].first.toStdString();
+	const std::string output_path = files[index].second.toStdString();
+
+	auto input = OIIO::ImageInput::open(input_path);
+	if (!input) {
+		throw std::runtime_error("Can't read the image. The file may be inaccessible, "
+								 "in an unsupported format or damaged.\nMessage:\n" + OIIO::geterror());
+	}
+	const OIIO::ImageSpec in_spec = input->spec();
+
+	// Output rows per input row, and the input rows around a strip that affect it.
+	int scale, halo;
+	chain_scale_and_halo(scale, halo);
+
+	auto output = OIIO::ImageOutput::create(output_path);
+	if (!output)
+		throw std::runtime_error("Can't write the image. The format is not supported.\nMessage:\n" + OIIO::geterror());
+
+	// Formats with tiles get the tiles of the fixed size, so every strip is a row of tiles.
+	const bool tiled = output->supports("tiles");
+	const int rows = stream_strip_rows(strip_height, in_spec.height, tiled);
+
+	OIIO::ImageSpec out_spec = in_spec;
+	out_spec.x = out_spec.y = out_spec.z = 0;
+	out_spec.width = out_spec.full_width = in_spec.width * scale;
+	out_spec.height = out_spec.full_height = in_spec.height * scale;
+	out_spec.full_x = out_spec.full_y = 0;
+	out_spec.tile_width = out_spec.tile_height = tiled ? STREAM_TILE_SIZE : 0;
+	out_spec.tile_depth = tiled ? 1 : 0;
+	if (!output->open(output_path, out_spec)) {
+		throw std::runtime_error("Can't write the image. The path may be non existent or "
+								 "inaccessible.\nMessage:\n" + output->geterror());
+	}
+
+	slot.cur_strip = 0;
+	slot.strips_amount = (in_spec.height + rows - 1) / rows;
+	std::vector<float> in_pixels;
+	std::vector<float> out_pixels;
+	// The partial output is removed on cancellation and on any error (of reading, of the tasks
+	// or of writing), so no truncated image is left.
+	const auto discard_output = [&]() {
+		output->close();
+		QFile::remove(files[index].second);
+		slot.strips_amount = 0;
+	};
+
+	try {
+		for (int s = 0; s < slot.strips_amount; s++) {
+			slot.cur_strip = s;
+			const int ybegin = s * rows;
+			const int yend = std::min(ybegin + rows, in_spec.height);
+			const int read_begin = std::max(ybegin - halo, 0);
+			const int read_end = std::min(yend + halo, in_spec.height);
+
+			const auto decode_start = std::chrono::steady_clock::now();
+			in_pixels.resize(static_cast<size_t>(in_spec.width) * (read_end - read_begin) * in_spec.nchannels);
+			if (!read_rows(*input, read_begin, read_end, in_pixels.data())) {
+				throw std::runtime_error("Can't read the image. The file may be damaged.\nMessage:\n" +
+										 input->geterror());
 			}
+			PlanarImage strip = PlanarImage::from_interleaved(in_pixels.data(), in_spec.width, read_end - read_begin,
+															  in_spec.nchannels);
+			const double decode_ms = func::elapsed_ms(decode_start);
+			record_timings(index, [&](ImageTimings& t) { t.decode_ms += decode_ms; });
 
-			for (cur_task = 0; cur_task < tasks.size(); cur_task++) {
-				auto temp_img_buf = cur_img_buf;
-				cur_img_buf = tasks[cur_task]->do_task(temp_img_buf, canceled);
+			for (int i = 0; i < slot.tasks.size(); i++) {
+				slot.cur_task = i;
+				const auto task_start = std::chrono::steady_clock::now();
+				strip = slot.tasks[i]->do_task(std::move(strip), canceled);
+				record_task_timings(slot, index, i, func::elapsed_ms(task_start));
 
 				if (cancel_requested) {
-					canceled();
-					return;
+					discard_output();
+					return false;
 				}
 			}
-			// Write image.
-			OIIO::ProgressCallback callback = [] (void* worker, float part) -> bool {
-				static_cast<Worker*>(worker)->img_writing_progress = part;
-				return true;
-			};
 
-			img_writing_now = true;
+			// Only the rows of the strip are written, the halo is thrown away.
+			const auto encode_start = std::chrono::steady_clock::now();
+			out_pixels.resize(static_cast<size_t>(out_spec.width) * (yend - ybegin) * scale * out_spec.nchannels);
+			strip.to_interleaved((ybegin - read_begin) * scale, (yend - read_begin) * scale, out_pixels.data());
+
+			const bool written = tiled ?
+				output->write_tiles(0, out_spec.width, ybegin * scale, yend * scale, 0, 1,
+									OIIO::TypeDesc::FLOAT, out_pixels.data()) :
+				output->write_scanlines(ybegin * scale, yend * scale, 0, OIIO::TypeDesc::FLOAT, out_pixels.data());
+			if (!written)
+				throw std::runtime_error("Can't write the image.\nMessage:\n" + output->geterror());
+			const double encode_ms = func::elapsed_ms(encode_start);
+			record_timings(index, [&](ImageTimings& t) { t.encode_ms += encode_ms; });
+		}
+
+		slot.strips_amount = 0;
+		if (!output->close())
+			throw std::runtime_error("Can't write the image.\nMessage:\n" + output->geterror());
+	}
+	catch (...) {
+		discard_output();
+		throw;
+	}
+
+	return true;
+}
+
+void Worker::write_images(BoundedQueue<PipelineImage>& processed) {
+	try {
+		PipelineImage image;
+		while (processed.pop(image)) {
+			if (cancel_requested || pipeline_failed)
+				break;
+
 			// OpenImageIO creates an invalid file if the callback parameter is passed, so don't pass it.
 			// TODO: check if it behaves normal now. Last check: 14.04.2022, OpenImageIO 2.3.14.0-1.
-			//cur_img_buf.write(files[cur_img].second.toStdString(), OIIO::TypeUnknown, OIIO::string_view(), callback, this);
-			cur_img_buf.write(files[cur_img].second.toStdString(), OIIO::TypeUnknown, OIIO::string_view());
-			img_writing_now = false;
+			//buf.write(files[image.index].second.toStdString(), OIIO::TypeUnknown, OIIO::string_view(), callback, this);
+			const auto encode_start = std::chrono::steady_clock::now();
+			OIIO::ImageBuf buf = image.pixels.to_image_buf(image.spec);
+			image.pixels = PlanarImage();
+			buf.set_write_format(image.spec.format);
+			buf.write(files[image.index].second.toStdString(), OIIO::TypeUnknown, OIIO::string_view());
 
-			if (cur_img_buf.has_error()) {
-				error(QString::fromStdString(
+			if (buf.has_error()) {
+				set_pipeline_error(QString::fromStdString(
 					"Can't write the image. The path may be non existent or "
 					"inaccessible.\nMessage:\n"
-					+ cur_img_buf.geterror()
+					+ buf.geterror()
 				));
-				return;
+				break;
 			}
+			const double encode_ms = func::elapsed_ms(encode_start);
+			record_timings(image.index, [&](ImageTimings& t) { t.encode_ms += encode_ms; });
+
+			// Let the next image in.
+			buf.clear();
+			memory_governor.release(image.reserved_memory);
+
+			images_written++;
 		}
-		everything_finished = true;
-#ifdef NDEBUG
 	}
-	catch (const std::runtime_error& e) {
-		error(e.what());
+	catch (const std::exception& e) {
+		set_pipeline_error(e.what());
+	}
+	catch (...) {
+		set_pipeline_error("Unknown error");
+	}
+
+	// Unblock the tasks stage if we stopped early.
+	processed.close();
+}
+
+void Worker::do_tasks(std::function<void()> success, std::function<void()> canceled,
+					  std::function<void(QString)> error) {
+	if (strip_height != 0 && !can_stream()) {
+		error("Images can't be processed by strips with these tasks. Only the color space conversion "
+			  "and the neural networks support strips.");
 		return;
 	}
-	catch (const std::exception& e) {
-		error(e.what());
+
+	// Disable "cancel_requested" in all tasks.
+	for (const auto& slot : slots) {
+		for (int i = 0; i < slot->tasks.size(); i++)
+			slot->tasks[i]->set_cancel_requested(false);
+	}
+
+	pipeline_failed = false;
+	pipeline_error.clear();
+	images_processed = 0;
+	images_written = 0;
+	img_writing_now = false;
+
+	{
+		ImageTimings empty;
+		empty.task_ms.assign(task_descs.size(), 0.0);
+		empty.network_construction_ms.assign(task_descs.size(), 0.0);
+		empty.network_execution_ms.assign(task_descs.size(), 0.0);
+
+		std::lock_guard<std::mutex> lock(timings_mutex);
+		timings.assign(files.size(), empty);
+		total_timings = empty;
+		run_ms = 0.0;
+	}
+	const auto run_start = std::chrono::steady_clock::now();
+
+	unsigned long long budget = memory_budget;
+	if (budget == 0) {
+		// Without free memory the budget is 0: the images go one by one with the smallest blocks.
+		// Only the memory that can't be read doesn't limit.
+		const auto free_memory = func::free_physical_memory();
+		budget = free_memory ? static_cast<unsigned long long>(*free_memory * AUTO_MEMORY_BUDGET_SHARE) : ULLONG_MAX;
+	}
+	memory_governor.reset(budget);
+
+	// Three stages connected with bounded queues: decoding and encoding happen
+	// in their own threads while the tasks are running on the other images.
+	// Every slot has its own thread in the tasks stage.
+	BoundedQueue<PipelineImage> decoded(std::max<size_t>(queue_depth, slots.size()));
+	BoundedQueue<PipelineImage> processed(std::max<size_t>(queue_depth, slots.size()));
+	std::thread reader_thread(&Worker::read_images, this, std::ref(decoded));
+	std::thread writer_thread(&Worker::write_images, this, std::ref(processed));
+
+	std::atomic<bool> was_cancelled = false;
+	// The slots get disjoint CPUs of the ones allowed to the process while there are enough of them.
+	const std::vector<int> cpus = func::allowed_cpus();
+	const int cpus_per_slot = std::max<int>(cpus.size() / slots.size(), 1);
+	std::vector<std::thread> slot_threads;
+	for (int s = 0; s < slots.size(); s++) {
+		slot_threads.emplace_back([&, s]() {
+			// An exception escaping the thread would terminate the program, so it is caught in every build.
+			const auto run = [&]() {
+				try {
+					if (!process_images(*slots[s], decoded, processed, canceled))
+						was_cancelled = true;
+				}
+				catch (const std::exception& e) {
+					set_pipeline_error(e.what());
+				}
+				catch (...) {
+					set_pipeline_error("Unknown error");
+				}
+			};
+
+			// A single slot uses all CPUs, as before.
+			if (slots.size() > 1) {
+				const int first = s * cpus_per_slot % cpus.size();
+				const int last = std::min<int>(first + cpus_per_slot, cpus.size());
+				func::run_restricted(std::vector<int>(cpus.begin() + first, cpus.begin() + last), run);
+			}
+			else {
+				run();
+			}
+
+			// Stop the other slots and the reader.
+			if (was_cancelled || pipeline_failed) {
+				decoded.close();
+				memory_governor.close();
+			}
+		});
+	}
+
+	for (auto& thread : slot_threads)
+		thread.join();
+
+	// Stop reading and let the writer finish the processed images.
+	img_writing_now = true;
+	decoded.close();
+	memory_governor.close();
+	processed.close();
+	reader_thread.join();
+	writer_thread.join();
+	img_writing_now = false;
+	{
+		std::lock_guard<std::mutex> lock(timings_mutex);
+		run_ms = func::elapsed_ms(run_start);
+	}
+
+	if (was_cancelled || cancel_requested) {
+		canceled();
 		return;
 	}
-	catch (...) {
-		error("Unknown error");
+
+	if (pipeline_failed) {
+		error(pipeline_error);
 		return;
 	}
-#endif
+
+	everything_finished = true;
 	success(); // If not canceled and no errors occured.
 }
 
 void Worker::cancel() {
-	tasks[get_cur_task_index()]->cancel_requested = true;
+	for (const auto& slot : slots) {
+		for (int i = 0; i < slot->tasks.size(); i++)
+			slot->tasks[i]->set_cancel_requested(true);
+	}
 	cancel_requested = true;
+	memory_governor.close();
 }
@@ -6,20 +6,44 @@
 
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
 #include <QStringList>
 #include <OpenImageIO/imagebuf.h>
 
 #include "TaskDesc.hpp"
 #include "Task.hpp"
+#include "BoundedQueue.hpp"
+#include "MemoryGovernor.hpp"
+#include "UpscalePlanner.hpp"
 
 class Worker {
 public:
+	/// Wall time of the stages of an image in milliseconds.
+	struct ImageTimings {
+		double decode_ms = 0.0;
+		double encode_ms = 0.0;
+		/// Time of every task, and the parts of it spent taking the neural networks from the cache
+		/// and executing them.
+		std::vector<double> task_ms;
+		std::vector<double> network_construction_ms;
+		std::vector<double> network_execution_ms;
+	};
+
 	Worker();
 	/// Not only construct, but also init().
 	Worker(const std::vector<std::shared_ptr<TaskDesc>>& tasks,
 		   const std::vector<std::pair<QString, QString>>& files);
 
 	/// Needed if the worker was constructed with default constructor.
+	/// The chain is rewritten by TaskChainOptimizer unless the optimization is disabled. The upscale tasks
+	/// are planned for the size of every image (see TaskUpscale), the plans for the first images are described
+	/// in get_chain_rewrites().
 	void init(std::vector<std::shared_ptr<TaskDesc>> task_descs,
 			  std::vector<std::pair<QString, QString>> files);
 	QString cur_status() const;
@@ -30,19 +54,156 @@ public:
 	/// Progress of all tasks and all images (from 0 to 1).
 	float overall_progress() const;
 
+	/// How many decoded images may wait for the tasks and how many processed
+	/// images may wait for the encoding. Caps the memory used by the pipeline.
+	void set_queue_depth(int depth);
+	/// How many images are processed at once. Every image gets its own tasks
+	/// (and neural networks) and its own share of the cores.
+	/// 0 chooses the amount automatically from the image sizes and memory consumption.
+	/// Must be called before do_tasks().
+	void set_concurrent_images(int amount);
+	int get_concurrent_images() const;
+	/// Read, process and write the images by strips of this amount of rows instead of whole images,
+	/// so the memory consumption doesn't depend on the image height. 0 disables the streaming.
+	/// Every task must support strips (see can_stream()). Must be called before do_tasks().
+	void set_strip_height(int rows);
+	/// True if every task of the chain can process the images strip by strip.
+	bool can_stream() const;
+	/// Memory that all images in flight may take, in bytes. The next image waits until its peak
+	/// demand fits, and the blocks of the neural networks are reduced if an image doesn't fit alone.
+	/// 0 (default) takes a part of the free memory (of the cgroup too) when do_tasks() starts.
+	void set_memory_budget(unsigned long long bytes);
+	/// Cancel, collapse and fuse the redundant tasks of the chain (see TaskChainOptimizer), enabled by default.
+	/// Must be called before init().
+	void set_chain_optimization(bool enabled);
+	/// The plans of the upscale tasks and what the chain optimization rewrote, empty if nothing.
+	QStringList get_chain_rewrites() const;
+
 	void do_tasks(std::function<void()> success, std::function<void()> canceled,
 				  std::function<void(QString)> error);
 	void cancel();
 
+	/// Share of every stage in the time spent so far by all stages of all images, like
+	/// "Decode 5%, SRCNN 9-5-5 64-32 90% (networks: build 1%, execute 85%), encode 5%".
+	/// Empty before anything is measured.
+	QString timings_summary() const;
+	/// Write the timings of every image and the totals of the last do_tasks() as JSON.
+	/// @returns false if the file can't be written.
+	bool write_report(const QString& path) const;
+
 private:
+	/// Image travelling between the stages of the pipeline.
+	struct PipelineImage {
+		int index = 0;
+		/// Pixels, converted from and to the interleaved buffer of the file only when it is read and written.
+		PlanarImage pixels;
+		/// Header of the file: its pixel format and metadata (attributes, channel names, alpha channel).
+		/// The result is written with them, in the format if the output format supports it.
+		OIIO::ImageSpec spec;
+		/// Memory reserved for the image in the governor until it is written.
+		unsigned long long reserved_memory = 0;
+		/// Memory limit of the neural networks for this image, 0 means no limit.
+		unsigned long long network_memory_limit = 0;
+	};
+
+	/// Chain of tasks that processes one image at a time.
+	/// Several slots process different images concurrently.
+	struct Slot {
+		std::vector<Task*> tasks;
+		/// Index of the image in progress, -1 if the slot is idle.
+		std::atomic<int> cur_img = -1;
+		std::atomic<int> cur_task = 0;
+		/// Strip in progress and amount of strips of the image, 0 if the image is not streamed.
+		std::atomic<int> cur_strip = 0;
+		std::atomic<int> strips_amount = 0;
+
+		~Slot() {
+			for (Task* task : tasks)
+				delete task;
+		}
+	};
+
 	/// Vector of pairs "original file - result file".
 	std::vector<std::pair<QString, QString>> files;
-	std::vector<Task*> tasks;
-	int cur_task = 0, cur_img = 0;
+	std::vector<std::shared_ptr<TaskDesc>> task_descs;
+	std::vector<std::unique_ptr<Slot>> slots;
+	int queue_depth = 2;
+	int strip_height = 0;
+	unsigned long long memory_budget = 0;
+	bool chain_optimization = true;
+	QStringList chain_rewrites;
+	/// Plans of the upscale tasks by the task, the input width, height and channels, for the estimates
+	/// (see planned_chain()) and for the upscale tasks of all slots.
+	mutable std::map<std::tuple<const TaskDesc*, int, int, int>, UpscalePlanner::Plan> upscale_plans;
+	/// Planners by the channels of the images.
+	mutable std::map<int, UpscalePlanner> upscale_planners;
+	mutable std::mutex upscale_plans_mutex;
+	MemoryGovernor memory_governor;
+	std::atomic<int> images_processed = 0;
+	std::atomic<int> images_written = 0;
 
+	// Written and read by the stages of the pipeline, the GUI and the progress thread of the CLI.
 	/// Image writing progress.
-	float img_writing_progress = 0.0f;
-	bool cancel_requested = false;
-	bool everything_finished = false;
-	bool img_writing_now = false;
+	std::atomic<float> img_writing_progress = 0.0f;
+	std::atomic<bool> cancel_requested = false;
+	std::atomic<bool> everything_finished = false;
+	/// True when all images are processed, but some of them are still being written.
+	std::atomic<bool> img_writing_now = false;
+
+	/// Timings of every image and their sums, written by all stages.
+	mutable std::mutex timings_mutex;
+	std::vector<ImageTimings> timings;
+	ImageTimings total_timings;
+	/// Wall time of the last do_tasks().
+	double run_ms = 0.0;
+
+	/// The first error that occured in any stage of the pipeline.
+	std::mutex pipeline_error_mutex;
+	QString pipeline_error;
+	std::atomic<bool> pipeline_failed = false;
+
+	/// Describe the plans of the upscale tasks (see TaskUpscale) for the sizes of the first images.
+	void describe_upscale_plans();
+	/// The chain with the upscale tasks replaced with theirs plans for the image of the size.
+	/// The estimates of the memory and the cores use it.
+	std::vector<std::shared_ptr<TaskDesc>> planned_chain(QSize size, int channels) const;
+	/// Plan of the upscale task of the chain for the image of the size before it, made on the first use.
+	/// Thread-safe.
+	UpscalePlanner::Plan upscale_plan(const TaskDesc& desc, QSize size, int channels) const;
+	/// Create the slots with theirs own tasks.
+	void create_slots(int amount);
+	/// Choose the amount of concurrent images from the image sizes, the heaviest
+	/// neural network of the chain, the amount of cores and the free memory.
+	int auto_concurrent_images() const;
+	/// The slot that processes the earliest image, it is shown in the status.
+	const Slot& status_slot() const;
+	/// Peak memory of processing an image of the size: the buffers of the tasks and, if with_networks,
+	/// the tensors of the neural networks with the memory limit (0 means no limit).
+	unsigned long long image_memory_demand(QSize size, int channels, unsigned long long network_limit = 0,
+										   bool with_networks = true) const;
+	/// Reserve the memory of the image in the governor, waiting for the other images if it doesn't fit.
+	/// Sets reserved_memory and network_memory_limit of the image.
+	/// @returns false if the pipeline is stopped.
+	bool admit_image(QSize size, int channels, PipelineImage& image);
+	/// Output rows per input row of the whole chain and the input rows around a strip that affect it.
+	void chain_scale_and_halo(int& scale, int& halo) const;
+
+	void set_pipeline_error(const QString& message);
+	/// Add the times to the timings of the image and to the totals.
+	void record_timings(int index, const std::function<void(ImageTimings&)>& record);
+	/// Record the time of the task of the slot and its neural network times.
+	void record_task_timings(const Slot& slot, int index, int task, double task_ms);
+	/// Decode stage. Reads the input images one by one.
+	void read_images(BoundedQueue<PipelineImage>& decoded);
+	/// Tasks stage. Runs every task of the slot on the decoded images.
+	/// @returns false if cancelled.
+	bool process_images(Slot& slot, BoundedQueue<PipelineImage>& decoded,
+						BoundedQueue<PipelineImage>& processed, std::function<void()> canceled);
+	/// Encode stage. Writes the processed images one by one.
+	void write_images(BoundedQueue<PipelineImage>& processed);
+	/// Read, process and write the image strip by strip in the tasks stage.
+	/// Every strip is processed with the halo of the whole chain, so the result is the same as with the whole image.
+	/// @returns false if cancelled.
+	/// @throws std::runtime_error if the image can't be read or written.
+	bool stream_image(Slot& slot, int index, std::function<void()> canceled);
 };
@@ -0,0 +1,390 @@
+/*
+ * ImageUpscalerQt - neural network inference benchmark
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include "../functions/func.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
+#include "../tasks/PlanarImage.hpp"
+
+/// Executions before the measured ones: the first ones touch the memory and warm up the caches.
+constexpr int WARMUP_ITERATIONS = 2;
+/// Floating point operations of the color space conversion of a pixel: 3x3 matrix and offset.
+constexpr unsigned long long COLOR_CONVERSION_OPERATIONS = 18;
+
+/// One measured configuration.
+struct Measurement {
+	QString kind;
+	QString architecture;
+	int block_size = 0;
+	int threads = 0;
+	/// Time of one execution (one tile of the block size).
+	double mean_ms = 0.0;
+	double min_ms = 0.0;
+	/// Output megapixels per second.
+	double megapixels_per_s = 0.0;
+	double gflops = 0.0;
+};
+
+/// Parse a comma-separated list of positive numbers like "64,128,256".
+/// @returns empty vector if the list is invalid.
+std::vector<int> parse_list(const QString& str) {
+	std::vector<int> result;
+	for (const QString& part : str.split(',', Qt::SkipEmptyParts)) {
+		bool ok;
+		const int value = part.trimmed().toInt(&ok);
+		if (!ok || value <= 0)
+			return {};
+		result.push_back(value);
+	}
+
+	return result;
+}
+
+/// 1, 2, 4, ... and all hardware threads.
+std::vector<int> default_thread_counts() {
+	std::vector<int> result;
+	for (int threads = 1; threads < func::hardware_threads(); threads *= 2)
+		result.push_back(threads);
+	result.push_back(func::hardware_threads());
+	return result;
+}
+
+/// Execute the network on random input and measure the time of every execution.
+/// @returns times in milliseconds.
+template<typename Network>
+std::vector<double> measure(Network& nn, int iterations) {
+	// The same input for every run, so the runs are comparable.
+	float* input = static_cast<float*>(nn.get_input_memory().get_data_handle());
+	const size_t input_size = nn.get_input_memory().get_desc().get_size() / sizeof(float);
+	std::mt19937 generator(0);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	for (size_t i = 0; i < input_size; i++)
+		input[i] = distribution(generator);
+
+	for (int i = 0; i < WARMUP_ITERATIONS; i++)
+		nn.execute();
+
+	std::vector<double> result;
+	for (int i = 0; i < iterations; i++) {
+		const auto start = std::chrono::steady_clock::now();
+		nn.execute();
+		const auto end = std::chrono::steady_clock::now();
+		result.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+
+	return result;
+}
+
+/// Convert the color space of a random planar image in place, like TaskConvertColorSpace and the luma-only
+/// networks do, and measure the time of every conversion. Only the first three planes are converted,
+/// so the other channels don't change the time.
+/// @returns times in milliseconds.
+std::vector<double> measure_color_space(ColorSpaceConversion conversion, int side, int iterations) {
+	PlanarImage image(side, side, 3);
+	std::mt19937 generator(0);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	for (int c = 0; c < image.channels(); c++) {
+		for (int y = 0; y < side; y++)
+			std::generate_n(image.row(c, y), side, [&]() { return distribution(generator); });
+	}
+
+	float* const planes[3] = {image.plane(0), image.plane(1), image.plane(2)};
+	for (int i = 0; i < WARMUP_ITERATIONS; i++)
+		func::convert_color_space(conversion, planes, image.plane_size());
+
+	std::vector<double> result;
+	for (int i = 0; i < iterations; i++) {
+		const auto start = std::chrono::steady_clock::now();
+		func::convert_color_space(conversion, planes, image.plane_size());
+		result.push_back(func::elapsed_ms(start));
+	}
+
+	return result;
+}
+
+/// Run the measurement in a thread restricted to the given amount of the allowed CPUs, like the Worker does.
+/// @param run Measures and fills the times.
+/// @throws std::runtime_error if the network can't be built.
+std::vector<double> measure_with_threads(int threads, const std::function<std::vector<double>()>& run) {
+	std::vector<double> result;
+	std::exception_ptr error;
+	std::thread thread([&]() {
+		std::vector<int> cpus = func::allowed_cpus();
+		cpus.resize(std::min<size_t>(threads, cpus.size()));
+		func::run_restricted(cpus, [&]() {
+			try {
+				result = run();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+		});
+	});
+	thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+	return result;
+}
+
+Measurement make_measurement(const QString& kind, const QString& architecture, int block_size, int threads,
+							 const std::vector<double>& times, unsigned long long output_pixels,
+							 unsigned long long operations) {
+	Measurement result;
+	result.kind = kind;
+	result.architecture = architecture;
+	result.block_size = block_size;
+	result.threads = threads;
+
+	double sum = 0.0;
+	for (double time : times)
+		sum += time;
+	result.mean_ms = sum / times.size();
+	result.min_ms = *std::min_element(times.begin(), times.end());
+	result.megapixels_per_s = output_pixels / 1'000'000.0 / (result.mean_ms / 1000.0);
+	result.gflops = operations / 1'000'000'000.0 / (result.mean_ms / 1000.0);
+	return result;
+}
+
+QJsonDocument to_json(const std::vector<Measurement>& measurements, Precision precision, int iterations) {
+	QJsonArray results;
+	for (const auto& m : measurements) {
+		results.append(QJsonObject{
+			{"kind", m.kind},
+			{"architecture", m.architecture},
+			{"block_size", m.block_size},
+			{"threads", m.threads},
+			{"mean_ms_per_tile", m.mean_ms},
+			{"min_ms_per_tile", m.min_ms},
+			{"megapixels_per_s", m.megapixels_per_s},
+			{"gflops", m.gflops}
+		});
+	}
+
+	const dnnl_version_t* version = dnnl_version();
+	const func::CacheSizes caches = func::cpu_cache_sizes();
+	return QJsonDocument(QJsonObject{
+		{"date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+		{"onednn_version", QString("%1.%2.%3").arg(version->major).arg(version->minor).arg(version->patch)},
+		{"onednn_isa", static_cast<int>(dnnl::get_effective_cpu_isa())},
+		{"hardware_threads", func::hardware_threads()},
+		{"l2_cache", static_cast<double>(caches.l2)},
+		{"l3_cache", static_cast<double>(caches.l3)},
+		{"precision", PRECISION_NAMES[static_cast<unsigned char>(NetworkCache::effective_precision(precision))]},
+		{"iterations", iterations},
+		{"results", results}
+	});
+}
+
+void write_csv(QTextStream& stream, const std::vector<Measurement>& measurements) {
+	stream << "kind,architecture,block_size,threads,mean_ms_per_tile,min_ms_per_tile,megapixels_per_s,gflops\n";
+	for (const auto& m : measurements) {
+		stream << m.kind << ",\"" << m.architecture << "\"," << m.block_size << ',' << m.threads << ','
+			   << m.mean_ms << ',' << m.min_ms << ',' << m.megapixels_per_s << ',' << m.gflops << '\n';
+	}
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-benchmark");
+	Q_INIT_RESOURCE(resources);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Measures the inference speed of every SRCNN and FSRCNN model for every block size and amount "
+		"of threads: time of one tile, output megapixels per second and GFLOP/s. With --color-space, "
+		"measures the color space conversions of the images with the block sizes as the sides instead."
+	);
+	parser.addHelpOption();
+
+	QCommandLineOption block_sizes_option({"b", "block-sizes"}, "Comma-separated block sizes "
+										  "(64,128,256 by default).", "sizes", "64,128,256");
+	QCommandLineOption threads_option({"j", "threads"}, "Comma-separated amounts of threads "
+									  "(1, 2, 4, ... and all hardware threads by default).", "amounts");
+	QCommandLineOption iterations_option({"n", "iterations"}, "Measured executions of every "
+										 "configuration (10 by default).", "amount", "10");
+	QCommandLineOption precision_option({"p", "precision"}, "f32 (default), bf16 or int8. int8 measures "
+										"only the networks with a quantized model.", "precision", "f32");
+	QCommandLineOption filter_option({"f", "filter"}, "Measure only the models whose kind and architecture "
+									 "(like \"fsrcnn x3 5-1-3-1-9 128-16-48-128\") contain this text.", "text");
+	QCommandLineOption color_space_option("color-space", "Measure the color space conversions (of 3 and 4 "
+										  "channel images) instead of the neural networks.");
+	QCommandLineOption format_option("format", "json (default) or csv.", "format", "json");
+	QCommandLineOption output_option({"o", "output"}, "Output file, the standard output by default.", "file");
+	parser.addOptions({block_sizes_option, threads_option, iterations_option, precision_option, filter_option,
+					   color_space_option, format_option, output_option});
+	parser.process(app);
+
+	const std::vector<int> block_sizes = parse_list(parser.value(block_sizes_option));
+	const std::vector<int> thread_counts = parser.isSet(threads_option) ?
+		parse_list(parser.value(threads_option)) : default_thread_counts();
+	bool iterations_ok;
+	const int iterations = parser.value(iterations_option).toInt(&iterations_ok);
+	if (block_sizes.empty() || thread_counts.empty() || !iterations_ok || iterations <= 0) {
+		std::cerr << "Block sizes, amounts of threads and iterations must be positive numbers." << std::endl;
+		return 2;
+	}
+
+	Precision precision = Precision::f32;
+	bool precision_found = false;
+	for (unsigned char i = 0; i < std::size(PRECISION_NAMES); i++) {
+		if (parser.value(precision_option).compare(PRECISION_NAMES[i], Qt::CaseInsensitive) == 0) {
+			precision = static_cast<Precision>(i);
+			precision_found = true;
+		}
+	}
+	const QString format = parser.value(format_option).toLower();
+	if (!precision_found || (format != "json" && format != "csv")) {
+		std::cerr << "Precision must be f32, bf16 or int8, format must be json or csv." << std::endl;
+		return 2;
+	}
+
+	// Every model of the store, a network may have both the raw parameters and the container.
+	std::vector<SRCNNDesc> srcnns;
+	std::vector<FSRCNNDesc> fsrcnns;
+	const QString filter = parser.value(filter_option);
+	const bool color_space = parser.isSet(color_space_option);
+	for (const QString& file_name : ModelStore::instance().model_names("srcnn")) {
+		SRCNNDesc desc;
+		if ((file_name.endsWith(".bin") || file_name.endsWith(".ium")) &&
+			SRCNNDesc::from_string(file_name.chopped(4), &desc) &&
+			("srcnn " + desc.to_string()).contains(filter, Qt::CaseInsensitive) &&
+			std::find(srcnns.begin(), srcnns.end(), desc) == srcnns.end())
+			srcnns.push_back(desc);
+	}
+	for (const QString& file_name : ModelStore::instance().model_names("fsrcnn")) {
+		FSRCNNDesc desc;
+		if ((file_name.endsWith(".bin") || file_name.endsWith(".ium")) &&
+			FSRCNNDesc::from_string(file_name.chopped(4), &desc) &&
+			("fsrcnn " + desc.to_string()).contains(filter, Qt::CaseInsensitive) &&
+			std::find(fsrcnns.begin(), fsrcnns.end(), desc) == fsrcnns.end())
+			fsrcnns.push_back(desc);
+	}
+	std::sort(srcnns.begin(), srcnns.end());
+	std::sort(fsrcnns.begin(), fsrcnns.end());
+
+	if (precision == Precision::int8) {
+		srcnns.erase(std::remove_if(srcnns.begin(), srcnns.end(), [](const SRCNNDesc& desc) {
+			return !QFile::exists(NetworkCache::quantized_model_path("srcnn", desc.to_string()));
+		}), srcnns.end());
+		fsrcnns.erase(std::remove_if(fsrcnns.begin(), fsrcnns.end(), [](const FSRCNNDesc& desc) {
+			return !QFile::exists(NetworkCache::quantized_model_path("fsrcnn", desc.to_string()));
+		}), fsrcnns.end());
+	}
+
+	if (color_space) {
+		srcnns.clear();
+		fsrcnns.clear();
+	}
+	else if (srcnns.empty() && fsrcnns.empty()) {
+		std::cerr << "No models to measure." << std::endl;
+		return 2;
+	}
+
+	std::vector<Measurement> measurements;
+	try {
+		for (const auto& desc : srcnns) {
+			for (int block_size : block_sizes) {
+				const QSize size(block_size, block_size);
+				for (int threads : thread_counts) {
+					const auto times = measure_with_threads(threads, [&]() {
+						return measure(*NetworkCache::instance().acquire_srcnn(desc, size, 1, precision), iterations);
+					});
+					measurements.push_back(make_measurement("srcnn", desc.to_string(), block_size, threads, times,
+						static_cast<unsigned long long>(block_size) * block_size,
+						func::srcnn_operations_amount(desc, size)));
+					std::cerr << '.' << std::flush;
+				}
+			}
+
+			// Don't keep the networks of all models.
+			NetworkCache::instance().clear();
+		}
+
+		for (const auto& desc : fsrcnns) {
+			for (int block_size : block_sizes) {
+				const QSize size(block_size, block_size);
+				for (int threads : thread_counts) {
+					const auto times = measure_with_threads(threads, [&]() {
+						return measure(*NetworkCache::instance().acquire_fsrcnn(desc, size, 1, precision), iterations);
+					});
+					const unsigned long long output_side = static_cast<unsigned long long>(block_size) *
+						desc.size_multiplier;
+					measurements.push_back(make_measurement("fsrcnn", desc.to_string(), block_size, threads, times,
+						output_side * output_side, func::fsrcnn_operations_amount(desc, size)));
+					std::cerr << '.' << std::flush;
+				}
+			}
+
+			NetworkCache::instance().clear();
+		}
+
+		for (unsigned char c = 0; color_space && c < std::size(COLOR_SPACE_CONVERSION_NAMES); c++) {
+			const auto conversion = static_cast<ColorSpaceConversion>(c);
+			const QString name = COLOR_SPACE_CONVERSION_NAMES[c];
+			if (!("colorspace " + name).contains(filter, Qt::CaseInsensitive))
+				continue;
+
+			for (int side : block_sizes) {
+				const unsigned long long pixels = static_cast<unsigned long long>(side) * side;
+				for (int threads : thread_counts) {
+					const auto times = measure_with_threads(threads, [&]() {
+						return measure_color_space(conversion, side, iterations);
+					});
+					measurements.push_back(make_measurement("colorspace", name, side, threads, times, pixels,
+															pixels * COLOR_CONVERSION_OPERATIONS));
+					std::cerr << '.' << std::flush;
+				}
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << std::endl << e.what() << std::endl;
+		return 1;
+	}
+	std::cerr << std::endl;
+
+	// Write the results.
+	QFile output_file;
+	if (parser.isSet(output_option)) {
+		output_file.setFileName(parser.value(output_option));
+		if (!output_file.open(QFile::WriteOnly | QFile::Text)) {
+			std::cerr << "Can't open \"" << parser.value(output_option).toStdString() << "\" for writing." << std::endl;
+			return 1;
+		}
+	}
+	else {
+		output_file.open(stdout, QFile::WriteOnly | QFile::Text);
+	}
+
+	QTextStream stream(&output_file);
+	if (format == "json")
+		stream << to_json(measurements, precision, iterations).toJson();
+	else
+		write_csv(stream, measurements);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * ImageUpscalerQt - int8 quantization calibration
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QPoint>
+#include <OpenImageIO/imagebuf.h>
+
+#include "../cli/CommandLine.hpp"
+#include "../functions/func.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
+
+/// Size of the sample blocks taken from the images.
+constexpr int SAMPLE_BLOCK_SIZE = 128;
+/// Maximal amount of the sample blocks taken from one image (evenly).
+constexpr int MAX_SAMPLE_BLOCKS = 16;
+
+/// Run sample blocks of the images through the f32 network and measure the maximal absolute value
+/// of the source of every layer. The maximum is used as the range, so no activation is clipped.
+/// @param nn f32 network with the input of SAMPLE_BLOCK_SIZE x SAMPLE_BLOCK_SIZE and one image in the minibatch.
+/// @returns amount of the sample blocks.
+template<typename Network>
+int measure_ranges(Network& nn, const QStringList& inputs, bool luma_only, std::vector<float>& src_max) {
+	int samples = 0;
+	float* block_pixels = static_cast<float*>(nn.get_input_memory().get_data_handle());
+
+	for (const QString& input_path : inputs) {
+		OIIO::ImageBuf image(input_path.toStdString());
+		if (!image.read(0, 0, true, OIIO::TypeDesc::FLOAT)) {
+			std::cerr << "Can't read \"" << input_path.toStdString() << "\"." << std::endl;
+			continue;
+		}
+
+		// The neural network sees only the luma in this mode.
+		int channels = image.nchannels();
+		if (luma_only && channels >= 3) {
+			const auto& spec = image.spec();
+			OIIO::ImageBuf ycbcr(OIIO::ImageSpec(spec.width, spec.height, 3, OIIO::TypeDesc::FLOAT));
+			OIIO::ROI color_roi = image.roi();
+			color_roi.chbegin = 0;
+			color_roi.chend = 3;
+			image.get_pixels(color_roi, OIIO::TypeDesc::FLOAT, ycbcr.localpixels());
+			func::rgb_to_ycbcr(static_cast<float*>(ycbcr.localpixels()),
+							   static_cast<size_t>(spec.width) * spec.height);
+			image.swap(ycbcr);
+			channels = 1;
+		}
+
+		// Take the blocks evenly, but not more than MAX_SAMPLE_BLOCKS.
+		std::vector<QPoint> blocks;
+		for (int y = 0; y < image.spec().height; y += SAMPLE_BLOCK_SIZE) {
+			for (int x = 0; x < image.spec().width; x += SAMPLE_BLOCK_SIZE)
+				blocks.emplace_back(x, y);
+		}
+		const size_t step = std::max<size_t>(1, blocks.size() / MAX_SAMPLE_BLOCKS);
+
+		for (size_t i = 0; i < blocks.size(); i += step) {
+			for (int c = 0; c < channels; c++) {
+				OIIO::ROI block_roi(blocks[i].x(), blocks[i].x() + SAMPLE_BLOCK_SIZE,
+									blocks[i].y(), blocks[i].y() + SAMPLE_BLOCK_SIZE, 0, 1, c, c + 1);
+				image.get_pixels(block_roi, OIIO::TypeDesc::FLOAT, block_pixels);
+				nn.execute(nn.get_input_memory(), nn.get_output_memory(), &src_max);
+				samples++;
+			}
+		}
+	}
+
+	return samples;
+}
+
+/// Measure the ranges, quantize the parameters and write them.
+/// @throws std::runtime_error on errors.
+template<typename Network, typename Desc>
+void calibrate(std::shared_ptr<Network> nn, TaskKind kind, const Desc& desc, unsigned int size_multiplier,
+			   bool luma_only, const QStringList& inputs, const QString& output_path) {
+	std::vector<float> src_max;
+	const int samples = measure_ranges(*nn, inputs, luma_only, src_max);
+	if (samples == 0)
+		throw std::runtime_error("No sample images were read.");
+
+	std::cout << "Measured " << samples << " sample blocks." << std::endl;
+	for (size_t i = 0; i < src_max.size(); i++)
+		std::cout << "Layer " << i + 1 << ": source range " << src_max[i] << std::endl;
+
+	// The parameters in the plain layouts, a model container may have the blocked ones.
+	const auto ker_descs = nn->get_ker_descs();
+	const auto bias_descs = nn->get_bias_descs();
+	const std::vector<dnnl::memory::desc> plain_ker_descs(ker_descs.begin(), ker_descs.end());
+	std::shared_ptr<const NetworkParams> params = NetworkParams::load(
+		ModelStore::instance().network_model_path(kind == TaskKind::srcnn ? "srcnn" : "fsrcnn", desc.to_string()),
+		kind, size_multiplier, false,
+		plain_ker_descs,
+		std::vector<dnnl::memory::desc>(bias_descs.begin(), bias_descs.end()),
+		NetworkCache::instance().get_engine());
+	if (!params->has_kernel_descs(plain_ker_descs))
+		params = params->reordered(plain_ker_descs, NetworkCache::instance().get_engine());
+
+	const auto quantized = NetworkParams::quantize(*params, src_max, NetworkCache::instance().get_engine());
+	if (!QDir().mkpath(QFileInfo(output_path).absolutePath()))
+		throw std::runtime_error("Can't create the folder of \"" + output_path.toStdString() + "\".");
+	quantized->save(output_path, kind, size_multiplier);
+
+	std::cout << "Quantized model is written to \"" << output_path.toStdString() << "\"." << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-calibrate");
+	Q_INIT_RESOURCE(resources);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Creates the int8 model of a neural network. Sample images are run through the f32 network to "
+		"measure the range of the activations of every layer, then the parameters are quantized with "
+		"these ranges and written with theirs scales. Tasks with the int8 flag use this model.\n\n" +
+		QString(cli::TASK_SYNTAX_HELP)
+	);
+	parser.addHelpOption();
+	parser.addPositionalArgument("samples", "Sample images, similar to the images that will be processed.",
+								 "samples...");
+
+	QCommandLineOption task_option({"t", "task"}, "SRCNN or FSRCNN task. With the luma flag, the network "
+								   "is calibrated on the luma.", "task");
+	QCommandLineOption output_option({"o", "output"}, "Output file. By default, the model is written where "
+									 "the tasks look for it.", "file");
+	parser.addOptions({task_option, output_option});
+	parser.process(app);
+
+	QString error;
+	auto desc = cli::parse_task(parser.value(task_option), error);
+	if (desc == nullptr) {
+		std::cerr << error.toStdString() << std::endl;
+		return 2;
+	}
+
+	const QStringList inputs = cli::expand_inputs(parser.positionalArguments());
+	if (inputs.isEmpty()) {
+		std::cerr << "No sample images." << std::endl;
+		return 2;
+	}
+
+	const QSize block_size(SAMPLE_BLOCK_SIZE, SAMPLE_BLOCK_SIZE);
+	const auto output_path = [&](const QString& kind, const QString& desc_str) {
+		if (parser.isSet(output_option))
+			return parser.value(output_option);
+		return NetworkCache::quantized_model_path(kind, desc_str);
+	};
+
+	try {
+		if (auto srcnn_desc = dynamic_cast<const TaskSRCNNDesc*>(desc.get())) {
+			calibrate(NetworkCache::instance().acquire_srcnn(srcnn_desc->srcnn_desc, block_size),
+					  TaskKind::srcnn, srcnn_desc->srcnn_desc, 1, srcnn_desc->luma_only, inputs,
+					  output_path("srcnn", srcnn_desc->srcnn_desc.to_string()));
+		}
+		else if (auto fsrcnn_desc = dynamic_cast<const TaskFSRCNNDesc*>(desc.get())) {
+			calibrate(NetworkCache::instance().acquire_fsrcnn(fsrcnn_desc->fsrcnn_desc, block_size),
+					  TaskKind::fsrcnn, fsrcnn_desc->fsrcnn_desc, fsrcnn_desc->fsrcnn_desc.size_multiplier,
+					  fsrcnn_desc->luma_only, inputs,
+					  output_path("fsrcnn", fsrcnn_desc->fsrcnn_desc.to_string()));
+		}
+		else {
+			std::cerr << "The task must be SRCNN or FSRCNN." << std::endl;
+			return 2;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
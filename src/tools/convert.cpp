@@ -0,0 +1,144 @@
+/*
+ * ImageUpscalerQt - model container converter
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+
+#include "../cli/CommandLine.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
+
+/// Input size of the networks whose primitives choose the blocked layouts.
+constexpr int LAYOUT_BLOCK_SIZE = 128;
+
+/// Load the raw parameters of the network and write them to the model container.
+/// @param blocked Write the kernels in the layouts chosen by the primitives on this CPU.
+/// @throws std::runtime_error on errors.
+template<typename Network>
+void convert(std::shared_ptr<Network> nn, TaskKind kind, const QString& kind_name, const QString& desc,
+			 unsigned int size_multiplier, bool blocked, const QString& output_dir) {
+	const auto ker_descs = nn->get_ker_descs();
+	const auto bias_descs = nn->get_bias_descs();
+	std::shared_ptr<const NetworkParams> params = NetworkParams::load(
+		ModelStore::instance().model_path(kind_name, desc + ".bin"), kind, size_multiplier, false,
+		std::vector<dnnl::memory::desc>(ker_descs.begin(), ker_descs.end()),
+		std::vector<dnnl::memory::desc>(bias_descs.begin(), bias_descs.end()),
+		NetworkCache::instance().get_engine());
+
+	if (blocked) {
+		const auto prim_ker_descs = nn->get_prim_ker_descs();
+		params = params->reordered(std::vector<dnnl::memory::desc>(prim_ker_descs.begin(), prim_ker_descs.end()),
+								   NetworkCache::instance().get_engine());
+	}
+
+	const QString dir = output_dir + "/" + kind_name;
+	if (!QDir().mkpath(dir))
+		throw std::runtime_error("Can't create the folder \"" + dir.toStdString() + "\".");
+
+	const QString output_path = dir + "/" + desc + ".ium";
+	params->save(output_path, kind, size_multiplier);
+	std::cout << "\"" << output_path.toStdString() << "\" is written." << std::endl;
+}
+
+void convert_srcnn(const SRCNNDesc& desc, bool blocked, const QString& output_dir) {
+	convert(NetworkCache::instance().acquire_srcnn(desc, QSize(LAYOUT_BLOCK_SIZE, LAYOUT_BLOCK_SIZE)),
+			TaskKind::srcnn, "srcnn", desc.to_string(), 1, blocked, output_dir);
+}
+
+void convert_fsrcnn(const FSRCNNDesc& desc, bool blocked, const QString& output_dir) {
+	convert(NetworkCache::instance().acquire_fsrcnn(desc, QSize(LAYOUT_BLOCK_SIZE, LAYOUT_BLOCK_SIZE)),
+			TaskKind::fsrcnn, "fsrcnn", desc.to_string(), desc.size_multiplier, blocked, output_dir);
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-convert");
+	Q_INIT_RESOURCE(resources);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Converts the raw parameters of the neural networks (.bin) into model containers (.ium) with "
+		"the layer shapes and a checksum. The output folder gets the layout of the models folders, "
+		"like share/ImageUpscalerQt/models, where the tasks find the containers.\n\n" +
+		QString(cli::TASK_SYNTAX_HELP)
+	);
+	parser.addHelpOption();
+
+	QCommandLineOption task_option({"t", "task"}, "SRCNN or FSRCNN task whose network is converted "
+								   "(the flags are ignored).", "task");
+	QCommandLineOption all_option("all", "Convert all networks.");
+	QCommandLineOption output_option({"o", "output"}, "Output models folder.", "folder");
+	QCommandLineOption blocked_option("blocked", "Write the kernels in the blocked layouts of this CPU, "
+									  "so they are not reordered when loaded. Such containers are loaded only "
+									  "by the same oneDNN version and are reordered on the other CPUs.");
+	parser.addOptions({task_option, all_option, output_option, blocked_option});
+	parser.process(app);
+
+	if (!parser.isSet(output_option)) {
+		std::cerr << "Output folder must be specified with --output." << std::endl;
+		return 2;
+	}
+
+	std::vector<SRCNNDesc> srcnns;
+	std::vector<FSRCNNDesc> fsrcnns;
+	for (const QString& task_str : parser.values(task_option)) {
+		QString error;
+		auto desc = cli::parse_task(task_str, error);
+		if (desc == nullptr) {
+			std::cerr << error.toStdString() << std::endl;
+			return 2;
+		}
+
+		if (auto srcnn_desc = dynamic_cast<const TaskSRCNNDesc*>(desc.get())) {
+			srcnns.push_back(srcnn_desc->srcnn_desc);
+		}
+		else if (auto fsrcnn_desc = dynamic_cast<const TaskFSRCNNDesc*>(desc.get())) {
+			fsrcnns.push_back(fsrcnn_desc->fsrcnn_desc);
+		}
+		else {
+			std::cerr << "The task must be SRCNN or FSRCNN." << std::endl;
+			return 2;
+		}
+	}
+
+	if (parser.isSet(all_option)) {
+		for (const QString& file_name : ModelStore::instance().model_names("srcnn")) {
+			SRCNNDesc desc;
+			if (file_name.endsWith(".bin") && SRCNNDesc::from_string(file_name.chopped(4), &desc))
+				srcnns.push_back(desc);
+		}
+		for (const QString& file_name : ModelStore::instance().model_names("fsrcnn")) {
+			FSRCNNDesc desc;
+			if (file_name.endsWith(".bin") && FSRCNNDesc::from_string(file_name.chopped(4), &desc))
+				fsrcnns.push_back(desc);
+		}
+	}
+
+	if (srcnns.empty() && fsrcnns.empty()) {
+		std::cerr << "No networks to convert. Use --task or --all." << std::endl;
+		return 2;
+	}
+
+	const bool blocked = parser.isSet(blocked_option);
+	try {
+		for (const auto& desc : srcnns)
+			convert_srcnn(desc, blocked, parser.value(output_option));
+		for (const auto& desc : fsrcnns)
+			convert_fsrcnn(desc, blocked, parser.value(output_option));
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
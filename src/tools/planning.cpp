@@ -0,0 +1,96 @@
+/*
+ * ImageUpscalerQt - upscale planning check
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSize>
+
+#include "../tasks/TaskDesc.hpp"
+#include "../tasks/UpscalePlanner.hpp"
+
+/// Factors of the upscale, the ones of the networks (x3, x5) and between them.
+const std::vector<double> FACTORS = {1.25, 1.5, 2.0, 2.5, 3.0, 4.0, 5.0, 6.0, 8.0, 9.0, 10.0};
+/// Smallest scale of the resize after the networks that is not a waste of them.
+/// Upscaling x5 only to reduce by x0.4 is exactly what the planner must avoid.
+constexpr double MIN_SCALE_AFTER_NETWORKS = 0.5;
+
+/// Check the plan: it reaches the target, meets the quality floor and doesn't reduce heavily after the networks.
+/// @returns the problem, empty if none.
+QString check_plan(const UpscalePlanner::Plan& plan, QSize input_size, QSize target) {
+	if (!plan.meets_quality)
+		return "doesn't meet the quality floor";
+
+	QSize size = input_size;
+	bool after_networks = false;
+	for (const auto& task : plan.tasks) {
+		const QSize new_size = task->img_size_after(size);
+		if (task->task_kind() == TaskKind::fsrcnn || task->task_kind() == TaskKind::srcnn) {
+			after_networks = true;
+		}
+		else if (task->task_kind() == TaskKind::resize && after_networks &&
+				 std::min(static_cast<double>(new_size.width()) / size.width(),
+						  static_cast<double>(new_size.height()) / size.height()) < MIN_SCALE_AFTER_NETWORKS) {
+			return "reduces heavily after the networks";
+		}
+		size = new_size;
+	}
+
+	if (size != target)
+		return QString("makes %1x%2").arg(QString::number(size.width()), QString::number(size.height()));
+	return QString();
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-planning");
+	Q_INIT_RESOURCE(resources);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Plans the upscale task with the installed and bundled networks for every quality and for the factors "
+		"from x1.25 to x10, prints the plans and checks that every plan reaches the target, meets the quality "
+		"floor and doesn't reduce the result of the networks below x0.5."
+	);
+	parser.addHelpOption();
+
+	QCommandLineOption size_option({"s", "size"}, "Input image size (640x360 by default).", "WxH", "640x360");
+	QCommandLineOption channels_option({"c", "channels"}, "Channels of the input image (3 by default).",
+									   "channels", "3");
+	parser.addOptions({size_option, channels_option});
+	parser.process(app);
+
+	const QStringList size_parts = parser.value(size_option).split('x');
+	bool width_ok = false, height_ok = false, channels_ok;
+	const QSize input_size = size_parts.size() != 2 ? QSize() :
+		QSize(size_parts[0].toInt(&width_ok), size_parts[1].toInt(&height_ok));
+	const int channels = parser.value(channels_option).toInt(&channels_ok);
+	if (!width_ok || !height_ok || input_size.isEmpty() || !channels_ok || channels < 1) {
+		std::cerr << "The size must be like 640x360 and the channels must be positive." << std::endl;
+		return 2;
+	}
+
+	const UpscalePlanner planner(channels);
+	bool failed = false;
+	for (unsigned char quality = 0; quality < std::size(UPSCALE_QUALITY_NAMES); quality++) {
+		for (double factor : FACTORS) {
+			const TaskUpscaleDesc desc(QSize(), factor, static_cast<UpscaleQuality>(quality));
+			const auto plan = planner.plan(desc, input_size);
+			const QString problem = check_plan(plan, input_size, desc.img_size_after(input_size));
+
+			failed |= !problem.isEmpty();
+			std::cout << UpscalePlanner::plan_string(desc, input_size, plan).toStdString();
+			if (!problem.isEmpty())
+				std::cout << " FAILED: " << problem.toStdString();
+			std::cout << std::endl;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * ImageUpscalerQt - reduced precision measurement
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+
+#include "../cli/CommandLine.hpp"
+#include "../nn/NetworkCache.hpp"
+#include "../tasks/TaskSRCNN.hpp"
+#include "../tasks/TaskFSRCNN.hpp"
+
+/// Create the neural network task of the description with the given precision.
+/// @returns nullptr if the description is not a neural network.
+std::unique_ptr<Task> create_task(const TaskDesc* desc, Precision precision) {
+	if (auto srcnn_desc = dynamic_cast<const TaskSRCNNDesc*>(desc)) {
+		TaskSRCNNDesc copy = *srcnn_desc;
+		copy.precision = precision;
+		return std::make_unique<TaskSRCNN>(copy);
+	}
+	else if (auto fsrcnn_desc = dynamic_cast<const TaskFSRCNNDesc*>(desc)) {
+		TaskFSRCNNDesc copy = *fsrcnn_desc;
+		copy.precision = precision;
+		return std::make_unique<TaskFSRCNN>(copy);
+	}
+
+	return nullptr;
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-precision");
+	Q_INIT_RESOURCE(resources);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Runs a neural network task in f32 and in a reduced precision (bf16 or int8) and prints PSNR "
+		"of the reduced precision result against the f32 one.\n\n" + QString(cli::TASK_SYNTAX_HELP)
+	);
+	parser.addHelpOption();
+	parser.addPositionalArgument("inputs", "Input images.", "inputs...");
+
+	QCommandLineOption task_option({"t", "task"}, "SRCNN or FSRCNN task (the precision flag is ignored).", "task");
+	QCommandLineOption precision_option({"p", "precision"}, "Precision to compare with f32: bf16 (default) "
+										"or int8.", "precision", "bf16");
+	parser.addOptions({task_option, precision_option});
+	parser.process(app);
+
+	Precision precision;
+	const QString precision_str = parser.value(precision_option).toLower();
+	if (precision_str == PRECISION_NAMES[static_cast<unsigned char>(Precision::bf16)]) {
+		precision = Precision::bf16;
+	}
+	else if (precision_str == PRECISION_NAMES[static_cast<unsigned char>(Precision::int8)]) {
+		precision = Precision::int8;
+	}
+	else {
+		std::cerr << "Precision must be bf16 or int8." << std::endl;
+		return 2;
+	}
+
+	QString error;
+	auto desc = cli::parse_task(parser.value(task_option), error);
+	if (desc == nullptr) {
+		std::cerr << error.toStdString() << std::endl;
+		return 2;
+	}
+
+	auto f32_task = create_task(desc.get(), Precision::f32);
+	auto reduced_task = create_task(desc.get(), precision);
+	if (f32_task == nullptr) {
+		std::cerr << "The task must be SRCNN or FSRCNN." << std::endl;
+		return 2;
+	}
+
+	const QStringList inputs = cli::expand_inputs(parser.positionalArguments());
+	if (inputs.isEmpty()) {
+		std::cerr << "No input images." << std::endl;
+		return 2;
+	}
+
+	if (NetworkCache::effective_precision(precision) != precision) {
+		std::cerr << "The CPU doesn't support " << PRECISION_NAMES[static_cast<unsigned char>(precision)]
+				  << " natively, both results are computed in f32." << std::endl;
+	}
+
+	const auto cancelled = []() {};
+	double psnr_sum = 0;
+	int compared = 0;
+	for (const QString& input_path : inputs) {
+		OIIO::ImageBuf input(input_path.toStdString());
+		if (!input.read(0, 0, true, OIIO::TypeDesc::FLOAT)) {
+			std::cerr << "Can't read \"" << input_path.toStdString() << "\"." << std::endl;
+			continue;
+		}
+
+		OIIO::ImageBuf reference, result;
+		try {
+			// Both tasks get the same input, so the first one gets a copy.
+			PlanarImage pixels = PlanarImage::from_image_buf(input);
+			reference = f32_task->do_task(pixels.clone(), cancelled).to_image_buf();
+			result = reduced_task->do_task(std::move(pixels), cancelled).to_image_buf();
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+
+		auto comparison = OIIO::ImageBufAlgo::compare(result, reference, 0.0f, 0.0f);
+		if (comparison.error) {
+			std::cerr << "Can't compare the results of \"" << input_path.toStdString() << "\"." << std::endl;
+			continue;
+		}
+
+		std::cout << input_path.toStdString() << ": PSNR " << comparison.PSNR << " dB, max error "
+				  << comparison.maxerror << std::endl;
+		psnr_sum += comparison.PSNR;
+		compared++;
+	}
+
+	if (compared == 0)
+		return 1;
+
+	std::cout << "Mean PSNR: " << psnr_sum / compared << " dB." << std::endl;
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * ImageUpscalerQt - native resampling comparison
+ * SPDX-FileCopyrightText: 2022 Artem Kliminskyi, artemklim50@gmail.com
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSize>
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imagebufalgo.h>
+
+#include "../functions/func.hpp"
+#include "../tasks/PlanarImage.hpp"
+#include "../tasks/TaskDesc.hpp"
+
+/// Size of the generated image. Odd and different sizes catch the errors of the pixel centers and the axes.
+const QSize GENERATED_SIZE(67, 45);
+/// Output sizes relative to the input: enlarging and reducing by integer and fractional ratios,
+/// and different ratios of the axes.
+const std::vector<std::pair<double, double>> RATIOS = {
+	{2.0, 2.0}, {3.5, 3.5}, {1.25, 1.25}, {0.5, 0.5}, {0.3, 0.3}, {0.8, 0.8}, {2.0, 0.5}, {0.7, 1.6}
+};
+
+/// Single-channel image of uniform noise, the worst case for the differences of the weights at the edges.
+OIIO::ImageBuf generated_image() {
+	OIIO::ImageBuf result(OIIO::ImageSpec(GENERATED_SIZE.width(), GENERATED_SIZE.height(), 1,
+										  OIIO::TypeDesc::FLOAT));
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	for (OIIO::ImageBuf::Iterator<float> it(result); !it.done(); ++it)
+		it[0] = distribution(generator);
+	return result;
+}
+
+/// The same resize by OpenImageIO, like TaskResize did before the native resampling.
+OIIO::ImageBuf oiio_resize(const OIIO::ImageBuf& input, QSize size, Interpolation interpolation) {
+	const OIIO::ROI roi(0, size.width(), 0, size.height(), 0, 1, 0, input.nchannels());
+	if (interpolation == Interpolation::bilinear)
+		return OIIO::ImageBufAlgo::resample(input, true, roi);
+	return OIIO::ImageBufAlgo::resize(input, INTERPOLATION_OIIO_NAMES[static_cast<unsigned char>(interpolation)],
+									  0.0f, roi);
+}
+
+int main(int argc, char* argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imageupscalerqt-resampling");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Resizes the images with the native resampling (func::resample()) and with OpenImageIO for every natively "
+		"supported interpolation, enlarging and reducing, and prints the maximal absolute difference "
+		"and where it is. Without inputs, an image of noise is generated."
+	);
+	parser.addHelpOption();
+	parser.addPositionalArgument("inputs", "Input images.", "[inputs...]");
+
+	QCommandLineOption tolerance_option({"t", "tolerance"}, "Largest allowed difference (1e-4 by default).",
+										"tolerance", "1e-4");
+	parser.addOption(tolerance_option);
+	parser.process(app);
+
+	bool ok;
+	const double tolerance = parser.value(tolerance_option).toDouble(&ok);
+	if (!ok || tolerance < 0.0) {
+		std::cerr << "The tolerance must be a non-negative number." << std::endl;
+		return 2;
+	}
+
+	std::vector<std::pair<std::string, OIIO::ImageBuf>> inputs;
+	for (const QString& path : parser.positionalArguments()) {
+		OIIO::ImageBuf input(path.toStdString());
+		if (!input.read(0, 0, true, OIIO::TypeDesc::FLOAT)) {
+			std::cerr << "Can't read \"" << path.toStdString() << "\"." << std::endl;
+			return 2;
+		}
+		inputs.emplace_back(path.toStdString(), std::move(input));
+	}
+	if (inputs.empty())
+		inputs.emplace_back("noise", generated_image());
+
+	bool failed = false;
+	for (const auto& [name, input] : inputs) {
+		const PlanarImage planes = PlanarImage::from_image_buf(input);
+		for (unsigned char i = 0; i < std::size(INTERPOLATION_NAMES); i++) {
+			const Interpolation interpolation = static_cast<Interpolation>(i);
+			if (!func::native_resampling(interpolation))
+				continue;
+
+			for (const auto& [x_ratio, y_ratio] : RATIOS) {
+				const QSize size(std::max(1, static_cast<int>(std::lround(planes.width() * x_ratio))),
+								 std::max(1, static_cast<int>(std::lround(planes.height() * y_ratio))));
+				PlanarImage result(size.width(), size.height(), planes.channels());
+				for (int c = 0; c < planes.channels(); c++) {
+					func::resample(planes.plane(c), planes.width(), planes.height(), planes.row_stride(),
+								   result.plane(c), result.width(), result.height(), result.row_stride(),
+								   interpolation);
+				}
+				const OIIO::ImageBuf reference = oiio_resize(input, size, interpolation);
+				if (reference.has_error()) {
+					std::cerr << "OpenImageIO can't resize \"" << name << "\": " << reference.geterror() << std::endl;
+					return 1;
+				}
+
+				// The position of the largest difference tells if it is at the edges.
+				const PlanarImage expected = PlanarImage::from_image_buf(reference);
+				float max_error = 0.0f;
+				int max_x = 0, max_y = 0, max_c = 0;
+				for (int c = 0; c < result.channels(); c++) {
+					for (int y = 0; y < result.height(); y++) {
+						const float* row = result.row(c, y);
+						const float* expected_row = expected.row(c, y);
+						for (int x = 0; x < result.width(); x++) {
+							const float error = std::abs(row[x] - expected_row[x]);
+							if (error > max_error) {
+								max_error = error;
+								max_x = x;
+								max_y = y;
+								max_c = c;
+							}
+						}
+					}
+				}
+
+				const bool passed = max_error <= tolerance;
+				failed |= !passed;
+				std::cout << name << ", " << INTERPOLATION_NAMES[i] << ", " << planes.width() << "x"
+						  << planes.height() << " -> " << size.width() << "x" << size.height() << ": max error "
+						  << max_error << " at (" << max_x << ", " << max_y << ") of channel " << max_c
+						  << (passed ? "" : " FAILED") << std::endl;
+			}
+		}
+	}
+
+	return failed ? 1 : 0;
+}
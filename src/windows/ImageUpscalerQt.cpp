@@ -94,9 +94,11 @@ unsigned long long ImageUpscalerQt::max_nn_memory_consumption() {
 
 		if (tasks[i]->task_kind() == TaskKind::srcnn) {
 			TaskSRCNNDesc* desc = static_cast<TaskSRCNNDesc*>(tasks[i].get());
-			QSize cur_block_size = desc->block_size == 0 ?
+			const int block_size = desc->block_size == AUTO_BLOCK_SIZE ?
+				func::auto_block_size(desc->srcnn_desc, cur_max_img_size) : desc->block_size;
+			QSize cur_block_size = block_size == 0 ?
 				cur_max_img_size :
-				QSize(desc->block_size, desc->block_size);
+				QSize(block_size, block_size);
 
 			unsigned long long cur_mem =
 				func::predict_cnn_memory_consumption(desc->srcnn_desc, cur_block_size);
@@ -105,9 +107,11 @@ unsigned long long ImageUpscalerQt::max_nn_memory_consumption() {
 		}
 		else if (tasks[i].get()->task_kind() == TaskKind::fsrcnn) {
 			TaskFSRCNNDesc* desc = static_cast<TaskFSRCNNDesc*>(tasks[i].get());
-			QSize cur_block_size = desc->block_size == 0 ?
+			const int block_size = desc->block_size == AUTO_BLOCK_SIZE ?
+				func::auto_block_size(desc->fsrcnn_desc, cur_max_img_size) : desc->block_size;
+			QSize cur_block_size = block_size == 0 ?
 				cur_max_img_size :
-				QSize(desc->block_size, desc->block_size);
+				QSize(block_size, block_size);
 
 			unsigned long long cur_mem =
 				func::predict_cnn_memory_consumption(desc->fsrcnn_desc, cur_block_size);
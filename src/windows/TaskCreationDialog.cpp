@@ -4,13 +4,16 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
-#include <QDirIterator>
+#include <QComboBox>
+#include <QFile>
 #include <QPushButton>
 
 #include "TaskCreationDialog.hpp"
 #include "ui_TaskCreationDialog.h"
 
 #include "../functions/func.hpp"
+#include "../nn/ModelStore.hpp"
+#include "../nn/NetworkCache.hpp"
 
 constexpr int DEF_RES = 512;
 constexpr size_t ORANGE_MEM = 1ull * 1024ull * 1024ull * 1024ull; // 1 GiB.
@@ -145,22 +148,53 @@ void TaskCreationDialog::ccs_combo_box_changed(int) {
 }
 // END TaskConvertColorSpace
 
+// BEGIN Neural networks
+/// Fill the combo box with the precisions available for the network on this computer:
+/// bf16 needs the CPU support, int8 needs the quantized model. The selection is kept if possible.
+void update_precision_combo_box(QComboBox* combo_box, const QString& kind, const QString& desc) {
+	const QVariant selected = combo_box->currentData();
+
+	combo_box->clear();
+	combo_box->addItem(PRECISION_NAMES[static_cast<unsigned char>(Precision::f32)],
+					   static_cast<int>(Precision::f32));
+	if (NetworkCache::effective_precision(Precision::bf16) == Precision::bf16) {
+		combo_box->addItem(PRECISION_NAMES[static_cast<unsigned char>(Precision::bf16)],
+						   static_cast<int>(Precision::bf16));
+	}
+	if (QFile::exists(NetworkCache::quantized_model_path(kind, desc))) {
+		combo_box->addItem(PRECISION_NAMES[static_cast<unsigned char>(Precision::int8)],
+						   static_cast<int>(Precision::int8));
+	}
+
+	combo_box->setCurrentIndex(std::max(combo_box->findData(selected), 0));
+}
+
+/// Size of the blocks with the halo around them, the neural network processes them.
+QSize halo_window_size(QSize block_size, int halo, QSize image_size) {
+	return QSize(std::min(block_size.width() + halo * 2, image_size.width()),
+				 std::min(block_size.height() + halo * 2, image_size.height()));
+}
+// END Neural networks
+
 // BEGIN TaskSRCNN
 void TaskCreationDialog::init_srcnn() {
 	srcnn_list.clear();
 
-	// Iterate through all resources to find SRCNNs and add them to our list (vector).
-	QDirIterator iter(":/srcnn");
-	while (iter.hasNext()) {
+	// Iterate through all models to find SRCNNs and add them to our list (vector).
+	for (const QString& file_name : ModelStore::instance().model_names("srcnn")) {
+		if (!file_name.endsWith(".bin") && !file_name.endsWith(".ium"))
+			continue;
+
 		SRCNNDesc cur_desc;
 		// Leave only filename without extension to pass it to the parser.
-		QString cur_desc_str = iter.next().section('/', -1).section('.', -2, -2);
+		QString cur_desc_str = file_name.section('.', -2, -2);
 		if (SRCNNDesc::from_string(cur_desc_str, &cur_desc)) // If parsing successful.
 			srcnn_list.push_back(cur_desc);
 	}
 
-	// Sort this list
+	// Sort this list. A network may have both the raw parameters and the model container.
 	std::sort(srcnn_list.begin(), srcnn_list.end());
+	srcnn_list.erase(std::unique(srcnn_list.begin(), srcnn_list.end()), srcnn_list.end());
 
 	// Add entries to combo box.
 	m_ui->srcnn_architecture_combo_box->clear();
@@ -176,6 +210,12 @@ bool TaskCreationDialog::valid_srcnn() {
 }
 
 QSize TaskCreationDialog::srcnn_block_size() {
+	if (m_ui->srcnn_split_check_box->isChecked() && m_ui->srcnn_auto_block_size_check_box->isChecked()) {
+		if (size.isNull())
+			return size;
+		const int block_size = func::auto_block_size(srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()], size);
+		return block_size == 0 ? size : QSize(block_size, block_size).boundedTo(size);
+	}
 	if (m_ui->srcnn_split_check_box->isChecked())
 		return QSize(m_ui->srcnn_block_size_spin_box->value(), m_ui->srcnn_block_size_spin_box->value());
 
@@ -184,7 +224,13 @@ QSize TaskCreationDialog::srcnn_block_size() {
 
 void TaskCreationDialog::srcnn_update() {
 	m_ui->main_button_box->button(QDialogButtonBox::Ok)->setEnabled(valid_srcnn());
-	m_ui->srcnn_block_size_spin_box->setEnabled(m_ui->srcnn_split_check_box->isChecked());
+	update_precision_combo_box(m_ui->srcnn_precision_combo_box, "srcnn",
+		srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()].to_string());
+	m_ui->srcnn_auto_block_size_check_box->setEnabled(m_ui->srcnn_split_check_box->isChecked());
+	m_ui->srcnn_block_size_spin_box->setEnabled(m_ui->srcnn_split_check_box->isChecked() &&
+											 !m_ui->srcnn_auto_block_size_check_box->isChecked());
+	const SRCNNDesc& srcnn_desc = srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()];
+	const QSize window_size = halo_window_size(srcnn_block_size(), srcnn_desc.halo(), size);
 
 	// Construct the memory consumption string.
 	QString mem_str;
@@ -192,9 +238,7 @@ void TaskCreationDialog::srcnn_update() {
 		mem_str = tr("unknown");
 	}
 	else {
-		unsigned long long mem = func::predict_cnn_memory_consumption(
-			srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()], srcnn_block_size()
-		);
+		unsigned long long mem = func::predict_cnn_memory_consumption(srcnn_desc, window_size);
 		mem_str = mem_consumption_to_string(mem);
 	}
 
@@ -204,9 +248,7 @@ void TaskCreationDialog::srcnn_update() {
 		opers_str = tr("unknown");
 	}
 	else {
-		unsigned long long opers = func::srcnn_operations_amount(
-			srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()], srcnn_block_size()
-		);
+		unsigned long long opers = func::srcnn_operations_amount(srcnn_desc, window_size);
 		opers *= func::blocks_amount(size, srcnn_block_size());
 		opers_str = func::big_number_to_string(opers);
 	}
@@ -220,13 +262,16 @@ void TaskCreationDialog::srcnn_update() {
 
 TaskSRCNNDesc TaskCreationDialog::create_srcnn() {
 	int block_size;
-	if (m_ui->srcnn_split_check_box->isChecked())
+	if (m_ui->srcnn_split_check_box->isChecked() && m_ui->srcnn_auto_block_size_check_box->isChecked())
+		block_size = AUTO_BLOCK_SIZE;
+	else if (m_ui->srcnn_split_check_box->isChecked())
 		block_size = m_ui->srcnn_block_size_spin_box->value();
 	else
 		block_size = 0;
 
 	return TaskSRCNNDesc(srcnn_list[m_ui->srcnn_architecture_combo_box->currentIndex()],
-						 block_size);
+						 block_size, m_ui->srcnn_luma_check_box->isChecked(),
+						 static_cast<Precision>(m_ui->srcnn_precision_combo_box->currentData().toInt()));
 }
 
 void TaskCreationDialog::srcnn_architecture_changed(int index) {
@@ -248,12 +293,11 @@ void TaskCreationDialog::srcnn_block_size_changed(int) {
 void TaskCreationDialog::update_fsrcnn_list() {
 	fsrcnn_list.clear();
 
-	// Iterate through all resources to find SRCNNs and add them to our list (vector).
-	QDirIterator iter(":/fsrcnn");
-	while (iter.hasNext()) {
-		QString cur_file_name = iter.next().section('/', -1);
+	// Iterate through all models to find FSRCNNs and add them to our list (vector).
+	for (const QString& cur_file_name : ModelStore::instance().model_names("fsrcnn")) {
 		// Allow only FSRCNNs with the selected size multiplier.
-		if (!cur_file_name.startsWith(m_ui->fsrcnn_multiplier_combo_box->currentText()))
+		if ((!cur_file_name.endsWith(".bin") && !cur_file_name.endsWith(".ium")) ||
+			!cur_file_name.startsWith(m_ui->fsrcnn_multiplier_combo_box->currentText()))
 			continue;
 
 		FSRCNNDesc cur_desc;
@@ -263,8 +307,9 @@ void TaskCreationDialog::update_fsrcnn_list() {
 			fsrcnn_list.push_back(cur_desc);
 	}
 
-	// Sort this list
+	// Sort this list. A network may have both the raw parameters and the model container.
 	std::sort(fsrcnn_list.begin(), fsrcnn_list.end());
+	fsrcnn_list.erase(std::unique(fsrcnn_list.begin(), fsrcnn_list.end()), fsrcnn_list.end());
 
 	// Add entries to combo box.
 	m_ui->fsrcnn_architecture_combo_box->clear();
@@ -283,6 +328,12 @@ bool TaskCreationDialog::valid_fsrcnn() {
 }
 
 QSize TaskCreationDialog::fsrcnn_block_size() {
+	if (m_ui->fsrcnn_split_check_box->isChecked() && m_ui->fsrcnn_auto_block_size_check_box->isChecked()) {
+		if (size.isNull())
+			return size;
+		const int block_size = func::auto_block_size(fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()], size);
+		return block_size == 0 ? size : QSize(block_size, block_size).boundedTo(size);
+	}
 	if (m_ui->fsrcnn_split_check_box->isChecked())
 		return QSize(m_ui->fsrcnn_block_size_spin_box->value(), m_ui->fsrcnn_block_size_spin_box->value());
 
@@ -291,9 +342,13 @@ QSize TaskCreationDialog::fsrcnn_block_size() {
 
 void TaskCreationDialog::fsrcnn_update() {
 	m_ui->main_button_box->button(QDialogButtonBox::Ok)->setEnabled(valid_fsrcnn());
-	m_ui->fsrcnn_block_size_spin_box->setEnabled(m_ui->fsrcnn_split_check_box->isChecked());
-	const int margin = m_ui->fsrcnn_block_size_spin_box->value();
-	m_ui->fsrcnn_margin_spin_box->setMinimum(-margin / 2);
+	update_precision_combo_box(m_ui->fsrcnn_precision_combo_box, "fsrcnn",
+		fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()].to_string());
+	m_ui->fsrcnn_auto_block_size_check_box->setEnabled(m_ui->fsrcnn_split_check_box->isChecked());
+	m_ui->fsrcnn_block_size_spin_box->setEnabled(m_ui->fsrcnn_split_check_box->isChecked() &&
+											 !m_ui->fsrcnn_auto_block_size_check_box->isChecked());
+	const FSRCNNDesc& fsrcnn_desc = fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()];
+	const QSize window_size = halo_window_size(fsrcnn_block_size(), fsrcnn_desc.halo(), size);
 
 	QString mem_str;
 	if (size.isNull()) {
@@ -301,9 +356,7 @@ void TaskCreationDialog::fsrcnn_update() {
 	}
 	else {
 		// Construct the memory consumption string.
-		unsigned long long mem = func::predict_cnn_memory_consumption(
-			fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()], fsrcnn_block_size()
-		);
+		unsigned long long mem = func::predict_cnn_memory_consumption(fsrcnn_desc, window_size);
 		mem_str = mem_consumption_to_string(mem);
 	}
 
@@ -313,10 +366,8 @@ void TaskCreationDialog::fsrcnn_update() {
 	}
 	else {
 		// Construct the operations amount string.
-		unsigned long long opers = func::fsrcnn_operations_amount(
-			fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()], fsrcnn_block_size()
-		);
-		opers *= func::blocks_amount(size, fsrcnn_block_size(), margin);
+		unsigned long long opers = func::fsrcnn_operations_amount(fsrcnn_desc, window_size);
+		opers *= func::blocks_amount(size, fsrcnn_block_size());
 		opers_str = func::big_number_to_string(opers);
 	}
 
@@ -329,14 +380,16 @@ void TaskCreationDialog::fsrcnn_update() {
 
 TaskFSRCNNDesc TaskCreationDialog::create_fsrcnn() {
 	int block_size;
-	if (m_ui->fsrcnn_split_check_box->isChecked())
+	if (m_ui->fsrcnn_split_check_box->isChecked() && m_ui->fsrcnn_auto_block_size_check_box->isChecked())
+		block_size = AUTO_BLOCK_SIZE;
+	else if (m_ui->fsrcnn_split_check_box->isChecked())
 		block_size = m_ui->fsrcnn_block_size_spin_box->value();
 	else
 		block_size = 0;
 
-	int margin = m_ui->fsrcnn_margin_spin_box->value();
 	return TaskFSRCNNDesc(fsrcnn_list[m_ui->fsrcnn_architecture_combo_box->currentIndex()],
-						  block_size, margin);
+						  block_size, m_ui->fsrcnn_luma_check_box->isChecked(),
+						  static_cast<Precision>(m_ui->fsrcnn_precision_combo_box->currentData().toInt()));
 }
 
 void TaskCreationDialog::fsrcnn_multiplier_changed(int) {
@@ -358,10 +411,6 @@ void TaskCreationDialog::fsrcnn_block_size_changed(int) {
 	fsrcnn_update();
 }
 
-void TaskCreationDialog::fsrcnn_margin_changed(int) {
-	fsrcnn_update();
-}
-
 // END TaskFSRCNN
 
 std::shared_ptr<TaskDesc> TaskCreationDialog::get_task_desc() {
@@ -80,5 +80,4 @@ private slots:
 	void fsrcnn_architecture_changed(int index);
 	void fsrcnn_split_changed(bool checked);
 	void fsrcnn_block_size_changed(int size);
-	void fsrcnn_margin_changed(int);
 };
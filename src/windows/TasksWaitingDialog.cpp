@@ -28,6 +28,7 @@ TasksWaitingDialog::TasksWaitingDialog() : m_ui(new Ui::TasksWaitingDialog) {
 
 	// BEGIN Connect signals
 	connect(m_ui->cancel_button, SIGNAL(clicked()), this, SLOT(cancel_clicked()));
+	connect(m_ui->save_report_button, SIGNAL(clicked()), this, SLOT(save_report_clicked()));
 	connect(timer, SIGNAL(timeout()), this, SLOT(progress_check()));
 	// END Connect signals
 }
@@ -41,6 +42,11 @@ void TasksWaitingDialog::do_tasks(std::vector<std::shared_ptr<TaskDesc>> tasks,
 	worker = new Worker(tasks, files);
 	tasks_complete = false;
 
+	// How the chain was rewritten and planned, before it runs.
+	const QStringList rewrites = worker->get_chain_rewrites();
+	m_ui->chain_rewrites_label->setText(rewrites.join('\n'));
+	m_ui->chain_rewrites_label->setVisible(!rewrites.isEmpty());
+
 	// Start tasks.
 	elapsed_timer.start(); // Start time.
 	tasks_thread = new std::thread(
@@ -72,12 +78,16 @@ void TasksWaitingDialog::progress_check() {
 	// Text for the time label.
 	m_ui->time_label->setText(func::milliseconds_to_string(elapsed_timer.elapsed()));
 
+	// Where the time goes: decoding, tasks or encoding.
+	m_ui->timings_label->setText(worker->timings_summary());
+
 	if (tasks_complete) {
 		// When completed.
 		m_ui->current_task_progressbar->setValue(100);
 		m_ui->overall_progressbar->setValue(100);
 		m_ui->current_task_label->setText("All tasks completed!");
 		m_ui->cancel_button->setEnabled(false); // Disable "Cancel" button.
+		m_ui->save_report_button->setEnabled(true);
 
 		timer->stop(); // Stop timer.
 		return;
@@ -99,6 +109,15 @@ void TasksWaitingDialog::progress_check() {
 	}
 }
 
+void TasksWaitingDialog::save_report_clicked() {
+	const QString path = QFileDialog::getSaveFileName(this, "Save the report", "report.json", "JSON (*.json)");
+	if (path.isEmpty())
+		return;
+
+	if (!worker->write_report(path))
+		QMessageBox::critical(this, "Error", QString("Can't write the report \"%1\".").arg(path));
+}
+
 void TasksWaitingDialog::cancel_clicked() {
 	worker->cancel();
 	m_ui->cancel_button->setEnabled(false); // Disable cancel button.
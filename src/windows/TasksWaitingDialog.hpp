@@ -48,5 +48,6 @@ private:
 
 private slots:
 	void cancel_clicked();
+	void save_report_clicked();
 	void progress_check();
 };